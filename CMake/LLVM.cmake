@@ -14,8 +14,11 @@ set(LLVM_LIBRARIES
         LLVMCore
         LLVMSupport
         LLVMPasses
+        LLVMTransformUtils
         LLVMIRReader
+        LLVMBitWriter
         LLVMExecutionEngine
+        LLVMOrcJIT
         LLVMX86AsmParser
         LLVMX86CodeGen
         LLVMTarget
@@ -1,30 +1,127 @@
 #include <stdio.h>
+#include <stdlib.h>
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <dlfcn.h>
 #endif
 #include <thread>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
 
 #include "SDL2/SDL.h"
+#include "lib.hpp"
+#include "triple_buffer.hpp"
 
 #define SCALE 16
 //#define NOGUI
 
 SDL_Window* window = nullptr;
 SDL_Renderer* renderer = nullptr;
+SDL_Texture* texture = nullptr;
 
 decltype(SDL_Init)* _SDL_Init = nullptr;
 decltype(SDL_CreateWindow)* _SDL_CreateWindow = nullptr;
 decltype(SDL_CreateRenderer)* _SDL_CreateRenderer = nullptr;
-decltype(SDL_SetRenderDrawColor)* _SDL_SetRenderDrawColor = nullptr;
-decltype(SDL_RenderClear)* _SDL_RenderClear = nullptr;
 decltype(SDL_RenderPresent)* _SDL_RenderPresent = nullptr;
-decltype(SDL_RenderDrawPoint)* _SDL_RenderDrawPoint = nullptr;
-decltype(SDL_RenderSetScale)* _SDL_RenderSetScale = nullptr;
-decltype(SDL_PollEvent)* _SDL_PollEvent = nullptr;
-decltype(SDL_GetTicks)* _SDL_GetTicks = nullptr;
-decltype(SDL_Delay)* _SDL_Delay = nullptr;
+decltype(SDL_CreateTexture)* _SDL_CreateTexture = nullptr;
+decltype(SDL_LockTexture)* _SDL_LockTexture = nullptr;
+decltype(SDL_UnlockTexture)* _SDL_UnlockTexture = nullptr;
+decltype(SDL_RenderCopy)* _SDL_RenderCopy = nullptr;
+decltype(SDL_WaitEventTimeout)* _SDL_WaitEventTimeout = nullptr;
+
+triple_buffer frames;
+
+/*
+ * Time as the guest sees it. Paced code reports every slice of instructions
+ * it is about to run through yield_frame. With virtual time the clock is the
+ * number of instructions granted so far, otherwise it is the monotonic clock.
+ */
+struct guest_clock
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto SECOND = clock::duration(std::chrono::seconds(1)).count();
+
+    uint32_t hz = 0;
+    bool virtual_time = false;
+    uint64_t retired = 0;
+    clock::time_point next;
+
+    clock::time_point now() const
+    {
+        if (!virtual_time) return clock::now();
+
+        return clock::time_point(clock::duration(retired / hz * SECOND + retired % hz * SECOND / hz));
+    }
+
+    // makes virtual time jump ahead to `until`
+    void advance(clock::time_point until)
+    {
+        auto ns = until.time_since_epoch().count();
+        retired = std::max<uint64_t>(retired, ns / SECOND * hz + (ns % SECOND * hz + SECOND - 1) / SECOND);
+    }
+
+    // instructions per 60 Hz frame
+    uint32_t slice() const
+    {
+        return std::max(1u, hz / 60);
+    }
+};
+
+guest_clock guest;
+
+/*
+ * A timer is only the value it was set to and when. Reads derive how many
+ * 60 Hz ticks have passed since from the guest clock, so nothing has to
+ * run in the background to count it down.
+ */
+struct countdown
+{
+    using clock = guest_clock::clock;
+
+    uint8_t value = 0;
+    clock::time_point set;
+
+    void write(uint8_t v)
+    {
+        value = v;
+        set = guest.now();
+    }
+
+    uint8_t read() const
+    {
+        if (!value) return 0;
+
+        auto ticks = (guest.now() - set) * 60 / std::chrono::seconds(1);
+        return ticks < value ? uint8_t(value - ticks) : 0;
+    }
+
+    // first point in time at which read() returns 0, rounded up
+    clock::time_point expiry() const
+    {
+        auto second = clock::duration(std::chrono::seconds(1)).count();
+        return set + clock::duration((value * second + 59) / 60);
+    }
+};
+
+countdown delay_timer;
+countdown sound_timer;
+
+std::atomic<uint16_t> keypad{ 0 };
+
+// CHIP8 key n is KEYMAP[n], the pad sits on the left of a qwerty keyboard
+constexpr SDL_Keycode KEYMAP[16] =
+{
+    SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+    SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+    SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+    SDLK_4, SDLK_r, SDLK_f, SDLK_v
+};
 
 template<typename T>
 T* get_addr(void* module, const char* proc)
@@ -36,25 +133,117 @@ T* get_addr(void* module, const char* proc)
     #endif
 }
 
+// only re-uploads or reprints the rows that changed since the last present
+void present(const frame& screen)
+{
+    if (!screen.dirty) return;
+
+    #ifndef NOGUI
+    // the texture keeps the other rows, lock the band that covers every dirty one
+    int first = 0;
+    int last = 31;
+    while (!(screen.dirty & (1u << first))) first++;
+    while (!(screen.dirty & (1u << last))) last--;
+
+    SDL_Rect band{ 0, first, 64, last - first + 1 };
+    void* pixels;
+    int pitch;
+    _SDL_LockTexture(texture, &band, &pixels, &pitch);
+
+    // one pass over the rows, every bit becomes an opaque white or black texel
+    for (int y = first; y <= last; ++y)
+    {
+        auto texels = (uint32_t*)((uint8_t*)pixels + (y - first) * pitch);
+        for (int x = 0; x < 64; ++x)
+            texels[x] = 0xff000000 | (0u - (uint32_t)((screen.rows[y] >> (63 - x)) & 1));
+    }
+
+    _SDL_UnlockTexture(texture);
+    _SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    _SDL_RenderPresent(renderer);
+    #else
+    // the terminal keeps the other rows, move the cursor to each dirty one and overwrite it
+    for (int y = 0; y < 32; ++y)
+    {
+        if (!(screen.dirty & (1u << y))) continue;
+
+        char line[64 + 1];
+        for (int x = 0; x < 64; ++x)
+            line[x] = (screen.rows[y] >> (63 - x)) & 1 ? 'x' : ' ';
+        line[64] = 0;
+
+        printf("\x1b[%d;1H%s", y + 1, line);
+    }
+    printf("\x1b[33;1H");
+    fflush(stdout);
+    #endif
+}
+
+// mirrors key presses into the keypad and wakes up a pending wait_key
+void handle(const SDL_Event& event)
+{
+    if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) return;
+
+    auto key = std::find(std::begin(KEYMAP), std::end(KEYMAP), event.key.keysym.sym);
+    if (key == std::end(KEYMAP)) return;
+
+    uint16_t bit = 1 << (key - std::begin(KEYMAP));
+    if (event.type == SDL_KEYDOWN)
+        keypad.fetch_or(bit, std::memory_order_relaxed);
+    else
+        keypad.fetch_and(~bit, std::memory_order_relaxed);
+
+    keypad.notify_all();
+}
+
+// presents the latest frame at 60 Hz, frames that did not change are skipped
+void present_loop()
+{
+    using clock = std::chrono::steady_clock;
+
+    auto next = clock::now();
+
+    while (true)
+    {
+        #ifndef NOGUI
+        // sleeps in SDL until an event arrives or the next frame is due
+        for (auto now = clock::now(); now < next; now = clock::now())
+        {
+            SDL_Event event;
+            auto timeout = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+            if (_SDL_WaitEventTimeout(&event, (int)timeout))
+                handle(event);
+        }
+        #else
+        std::this_thread::sleep_until(next);
+        #endif
+
+        if (auto screen = frames.latest())
+            present(*screen);
+
+        next += std::chrono::microseconds(16667);
+    }
+}
+
 extern "C" void init()
 {
     #ifdef _WIN32
     auto sdl = LoadLibraryA("SDL2.dll");
+    #elif defined __APPLE__
+    auto sdl = dlopen("libSDL2.dylib", RTLD_LAZY | RTLD_GLOBAL);
     #else
-    auto sdl = dlopen("libSDL2.dylib", RTLD_GLOBAL);
+    auto sdl = dlopen("libSDL2-2.0.so.0", RTLD_LAZY | RTLD_GLOBAL);
     #endif
     
     _SDL_Init = get_addr<decltype(SDL_Init)>(sdl, "SDL_Init");
     _SDL_CreateWindow = get_addr<decltype(SDL_CreateWindow)>(sdl, "SDL_CreateWindow");
     _SDL_CreateRenderer = get_addr<decltype(SDL_CreateRenderer)>(sdl, "SDL_CreateRenderer");
-    _SDL_SetRenderDrawColor = get_addr<decltype(SDL_SetRenderDrawColor)>(sdl, "SDL_SetRenderDrawColor");
-    _SDL_RenderClear = get_addr<decltype(SDL_RenderClear)>(sdl, "SDL_RenderClear");
     _SDL_RenderPresent = get_addr<decltype(SDL_RenderPresent)>(sdl, "SDL_RenderPresent");
-    _SDL_RenderDrawPoint = get_addr<decltype(SDL_RenderDrawPoint)>(sdl, "SDL_RenderDrawPoint");
-    _SDL_RenderSetScale = get_addr<decltype(SDL_RenderSetScale)>(sdl, "SDL_RenderSetScale");
-    _SDL_PollEvent = get_addr<decltype(SDL_PollEvent)>(sdl, "SDL_PollEvent");
-    _SDL_GetTicks = get_addr<decltype(SDL_GetTicks)>(sdl, "SDL_GetTicks");
-    _SDL_Delay = get_addr<decltype(SDL_Delay)>(sdl, "SDL_Delay");
+    _SDL_CreateTexture = get_addr<decltype(SDL_CreateTexture)>(sdl, "SDL_CreateTexture");
+    _SDL_LockTexture = get_addr<decltype(SDL_LockTexture)>(sdl, "SDL_LockTexture");
+    _SDL_UnlockTexture = get_addr<decltype(SDL_UnlockTexture)>(sdl, "SDL_UnlockTexture");
+    _SDL_RenderCopy = get_addr<decltype(SDL_RenderCopy)>(sdl, "SDL_RenderCopy");
+    _SDL_WaitEventTimeout = get_addr<decltype(SDL_WaitEventTimeout)>(sdl, "SDL_WaitEventTimeout");
 
     #ifndef NOGUI
     // thread crashes on macos
@@ -70,41 +259,15 @@ extern "C" void init()
             32 * SCALE,
             SDL_WINDOW_OPENGL
         );
-        renderer = _SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-        
-        _SDL_RenderSetScale(renderer, SCALE, SCALE);
+        renderer = _SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer)
+            renderer = _SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
 
-        while (true)
-        {
-            SDL_Event event;
-            while (_SDL_PollEvent(&event)) { }
-        }
-    }).detach();
-    #endif
-}
+        // the screen is uploaded as a 64x32 texture and stretched to the window on copy
+        texture = _SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 64, 32);
 
-extern "C" void start_delay_timer(char& dt)
-{
-    std::thread([&dt]()
-    { 
-        while (true)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-            if (dt > 0) dt--;
-        }
+        present_loop();
     }).detach();
-}
-
-/*
- * race condition:
- * first draw call may be called before renderer is initialized?
- * or maybe its refreshing too fast? SDL_Delay?
- */
-
-extern "C" void draw(char* screen)
-{
-    #ifndef NOGUI
-    while (!renderer || !window) {}
     #else
     #if defined _WIN32
     system("cls");
@@ -113,33 +276,105 @@ extern "C" void draw(char* screen)
     #elif defined (__APPLE__)
     system("clear");
     #endif
+
+    std::thread(present_loop).detach();
     #endif
+}
+
+extern "C" uint8_t get_delay_timer()
+{
+    return delay_timer.read();
+}
+
+extern "C" void set_delay_timer(uint8_t value)
+{
+    delay_timer.write(value);
+}
+
+extern "C" void wait_delay_timer()
+{
+    if (!delay_timer.value) return;
+
+    if (guest.virtual_time)
+        guest.advance(delay_timer.expiry());
+    else
+        std::this_thread::sleep_until(delay_timer.expiry());
+}
+
+extern "C" uint8_t get_sound_timer()
+{
+    return sound_timer.read();
+}
+
+extern "C" void set_sound_timer(uint8_t value)
+{
+    sound_timer.write(value);
+}
+
+extern "C" void set_clock(uint32_t hz, uint8_t virtual_time)
+{
+    guest.hz = hz;
+    guest.virtual_time = virtual_time;
+}
+
+// grants the next slice of instructions once it is due
+extern "C" int32_t yield_frame()
+{
+    auto slice = guest.slice();
+    guest.retired += slice;
 
-    for (int i = 0; i < 64 * 32; ++i)
+    if (guest.virtual_time) return slice;
+
+    // a guest that fell behind, e.g. while waiting for a key, does not get to catch up in a burst
+    auto frame = guest_clock::clock::duration(slice * guest_clock::SECOND / guest.hz);
+    auto now = guest_clock::clock::now();
+    if (now - guest.next > frame) guest.next = now;
+
+    std::this_thread::sleep_until(guest.next);
+    guest.next += frame;
+
+    return slice;
+}
+
+// parks on the keypad until a key that was up goes down
+extern "C" uint8_t wait_key()
+{
+    auto held = keypad.load(std::memory_order_relaxed);
+
+    while (true)
     {
-        int x = i % 64;
-        int y = (i / 64) % 32;
-        int color = screen[i] * 255;
+        keypad.wait(held, std::memory_order_relaxed);
 
-        #ifndef NOGUI
-        _SDL_SetRenderDrawColor(renderer, color, color, color, 255);
-        _SDL_RenderDrawPoint(renderer, x, y);
-        #else
-        // todo: there seems to be a bug:
-        // fishie rom without printfs will show empty screen
-        // render thread doesnt catch up with the drw calls?
-
-        if (i % 64 == 0) printf("\n");
-        
-        if (screen[i] == 1) printf("x");
-        else printf(" ");
-        #endif
+        auto keys = keypad.load(std::memory_order_relaxed);
+        if (auto pressed = (uint16_t)(keys & ~held))
+            return std::countr_zero(pressed);
+
+        held = keys;
     }
+}
 
-    #ifndef NOGUI
-    _SDL_RenderPresent(renderer);
-    #endif
+extern "C" void wait_keypad(uint8_t key, uint8_t held)
+{
+    uint16_t bit = 1 << (key & 0xf);
+
+    for (auto keys = keypad.load(std::memory_order_relaxed); bool(keys & bit) != bool(held); keys = keypad.load(std::memory_order_relaxed))
+        keypad.wait(keys, std::memory_order_relaxed);
+}
 
-    // wait for 60fps / vsync
-    //_SDL_Delay(1000);
-}
\ No newline at end of file
+extern "C" void unknown_jump(uint16_t addr)
+{
+    fprintf(stderr, "jp V0 reached 0x%03x, which is not lifted code\n", addr);
+    exit(1);
+}
+
+extern "C" void unknown_call(uint16_t addr)
+{
+    fprintf(stderr, "call reached 0x%03x, which is not lifted code\n", addr);
+    exit(1);
+}
+
+// only hands the frame over, the presenter picks it up on its next tick
+extern "C" void draw(const uint64_t* screen, uint32_t dirty)
+{
+    frames.publish(screen, dirty);
+}
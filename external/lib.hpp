@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Runtime used by lifted ROMs. It is either linked against the emitted
+ * module or resolved in-process when the module is executed by llvm8.
+ */
+
+extern "C" void init();
+
+// timers count down at 60 Hz from the value they were last set to
+extern "C" uint8_t get_delay_timer();
+extern "C" void set_delay_timer(uint8_t value);
+extern "C" uint8_t get_sound_timer();
+extern "C" void set_sound_timer(uint8_t value);
+
+// sleeps until the delay timer is 0
+extern "C" void wait_delay_timer();
+
+// runs the guest at hz instructions per second, on the retired instructions alone with virtual_time
+extern "C" void set_clock(uint32_t hz, uint8_t virtual_time);
+
+// called whenever the instruction budget is used up, returns the next one
+extern "C" int32_t yield_frame();
+
+// 32 rows of 64 pixels, the leftmost pixel of a row is its msb. Bit n of dirty is set if row n changed
+extern "C" void draw(const uint64_t* screen, uint32_t dirty);
+
+// bit n is set while key n is held, written by the event thread only
+extern "C" std::atomic<uint16_t> keypad;
+
+// blocks until a key goes down and returns it
+extern "C" uint8_t wait_key();
+
+// blocks until key is held (held != 0) or released (held == 0)
+extern "C" void wait_keypad(uint8_t key, uint8_t held);
+
+// jp V0, addr reached an address that was not lifted, ends the program
+extern "C" void unknown_jump(uint16_t addr);
+
+// call reached an address that was not lifted, ends the program
+extern "C" void unknown_call(uint16_t addr);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+struct frame
+{
+    std::array<uint64_t, 32> rows{};
+    uint32_t dirty = 0;
+};
+
+/*
+ * Hands frames from draw() to the presenter without either side waiting.
+ * The writer fills `back` and swaps it with `middle`, the reader swaps
+ * `front` with `middle` whenever the fresh bit says a new frame is there.
+ * Rows of frames that were replaced before they were presented stay dirty
+ * in the frame that replaced them.
+ */
+struct triple_buffer
+{
+    static constexpr int FRESH = 4;
+
+    std::array<frame, 3> frames{};
+    std::atomic<int> middle{ 1 };
+    int back = 0;
+    int front = 2;
+    // rows changed since the presenter last took a frame
+    uint32_t pending = 0;
+
+    void publish(const uint64_t* screen, uint32_t dirty)
+    {
+        std::copy(screen, screen + 32, frames[back].rows.begin());
+        pending |= dirty;
+        frames[back].dirty = pending;
+
+        auto previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & 3;
+
+        // the presenter took the previous frame, only this one is still unseen
+        if (!(previous & FRESH)) pending = dirty;
+    }
+
+    // latest frame or null if nothing was published since the last call
+    const frame* latest()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return nullptr;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return &frames[front];
+    }
+};
@@ -0,0 +1,811 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <algorithm>
+#include <functional>
+
+#include "utils.hpp"
+
+namespace analysis
+{
+    constexpr size_t ENTRY = 0x200;
+
+    using code_map = std::vector<bool>;
+    // sorted values a register may hold, nullopt if there are too many to track
+    using value_set = std::optional<std::vector<uint16_t>>;
+
+    // V0-VF followed by I
+    using register_sets = std::array<value_set, 17>;
+    using state_map = std::vector<std::optional<register_sets>>;
+
+    constexpr size_t I = 16;
+    constexpr size_t MAX_VALUES = 16;
+
+    // rom offset of a routine's entry to the code its body consists of, main is at offset 0
+    using body_map = std::map<size_t, code_map>;
+
+    enum class idle { none, delay_timer, key_down, key_up };
+
+    // rom offsets a jp V0 at a rom offset goes to, nullopt where the value sets do not know V0
+    using jump_map = std::map<size_t, std::optional<std::vector<size_t>>>;
+
+    uint16_t fetch(const std::vector<uint8_t>& data, size_t pc)
+    {
+        return (data[pc] << 8) | data[pc + 1];
+    }
+
+    /*
+     * Calls `callback` with the rom offset of every instruction that may execute
+     * after the one at `pc`. Targets outside of the rom are dropped.
+     */
+    template<typename F>
+    void for_each_successor(const std::vector<uint8_t>& data, size_t pc, F&& callback, const jump_map& jumps = {})
+    {
+        auto instruction = fetch(data, pc);
+        auto target = [&](size_t addr)
+        {
+            if (addr >= ENTRY && addr - ENTRY < data.size())
+                callback(addr - ENTRY);
+        };
+        auto next = [&](size_t n)
+        {
+            if (pc + 2 * n < data.size())
+                callback(pc + 2 * n);
+        };
+
+        switch (utils::get_nibble(instruction, 0))
+        {
+        case 0x0:
+            if (instruction == 0x00ee) break;
+            if (instruction == 0x00e0) next(1);
+            else target(utils::get_addr(instruction)); // sys is lifted as a jump
+            break;
+        case 0x1:
+            target(utils::get_addr(instruction));
+            break;
+        case 0x2:
+            target(utils::get_addr(instruction));
+            next(1);
+            break;
+        case 0x3: case 0x4: case 0x5: case 0x9:
+            next(1);
+            next(2);
+            break;
+        case 0xb:
+        {
+            auto resolved = jumps.find(pc);
+            if (resolved != jumps.end() && resolved->second)
+            {
+                for (auto succ : *resolved->second)
+                    callback(succ);
+                break;
+            }
+
+            // V0 picks the target, follow nnn and the table of jumps that usually starts there
+            size_t base = utils::get_addr(instruction);
+            target(base);
+            for (auto addr = base + 2; addr <= base + 0xff && addr >= ENTRY && addr - ENTRY + 1 < data.size(); addr += 2)
+            {
+                if ((fetch(data, addr - ENTRY) & 0xf000) != 0x1000) break;
+                target(addr);
+            }
+            break;
+        }
+        case 0xe:
+            next(1);
+            if ((instruction & 0xff) == 0x9e || (instruction & 0xff) == 0xa1) next(2);
+            break;
+        default:
+            next(1);
+            break;
+        }
+    }
+
+    // marks the code reachable from the rom offsets in `worklist`
+    void descend(const std::vector<uint8_t>& data, code_map& code, std::vector<size_t> worklist, const jump_map& jumps)
+    {
+        while (!worklist.empty())
+        {
+            auto pc = worklist.back();
+            worklist.pop_back();
+
+            if (pc + 1 >= data.size() || code[pc]) continue;
+
+            code[pc] = true;
+
+            // the lifter walks the rom in 2 byte steps
+            if (pc % 2)
+            {
+                if (utils::listing)
+                    printf("Ignoring misaligned instruction at 0x%zx\n", ENTRY + pc);
+                continue;
+            }
+
+            for_each_successor(data, pc, [&](size_t succ) { worklist.push_back(succ); }, jumps);
+        }
+    }
+
+    /*
+     * Code reachable from `entry` without entering called routines. A call
+     * continues after itself and a ret ends the path, so this is the body of
+     * the routine at `entry`.
+     */
+    code_map find_body(const std::vector<uint8_t>& data, const code_map& code, size_t entry, const jump_map& jumps)
+    {
+        code_map body(data.size(), false);
+        std::vector<size_t> worklist{ entry };
+
+        while (!worklist.empty())
+        {
+            auto pc = worklist.back();
+            worklist.pop_back();
+
+            if (pc >= code.size() || !code[pc] || body[pc] || pc % 2) continue;
+
+            body[pc] = true;
+
+            auto call = utils::get_nibble(fetch(data, pc), 0) == 0x2;
+            for_each_successor(data, pc, [&](size_t succ)
+            {
+                if (!call || succ == pc + 2) worklist.push_back(succ);
+            }, jumps);
+        }
+
+        return body;
+    }
+
+    // bodies of main and of every routine that is called from code
+    body_map find_bodies(const std::vector<uint8_t>& data, const code_map& code, const jump_map& jumps)
+    {
+        body_map bodies;
+        bodies[0] = find_body(data, code, 0, jumps);
+
+        for (size_t pc = 0; pc < code.size(); pc += 2)
+        {
+            if (!code[pc]) continue;
+
+            auto instruction = fetch(data, pc);
+            if (utils::get_nibble(instruction, 0) != 0x2) continue;
+
+            auto addr = utils::get_addr(instruction);
+            if (addr < ENTRY || addr - ENTRY >= code.size() || !code[addr - ENTRY]) continue;
+
+            if (!bodies.count(addr - ENTRY))
+                bodies[addr - ENTRY] = find_body(data, code, addr - ENTRY, jumps);
+        }
+
+        return bodies;
+    }
+
+    /*
+     * Deepest nesting of calls starting from main, which is the number of
+     * return addresses the guest stack has to hold. Routines that can reach
+     * themselves again have no bound.
+     */
+    std::optional<size_t> find_call_depth(const std::vector<uint8_t>& data, const body_map& bodies)
+    {
+        enum class state { unvisited, active, done };
+        std::map<size_t, state> states;
+        std::map<size_t, size_t> depths;
+        auto bounded = true;
+
+        std::function<size_t(size_t)> visit = [&](size_t entry)
+        {
+            if (states[entry] == state::active) bounded = false;
+            if (states[entry] != state::unvisited) return depths[entry];
+
+            states[entry] = state::active;
+
+            auto& body = bodies.at(entry);
+            size_t depth = 0;
+            for (size_t pc = 0; pc < body.size(); pc += 2)
+            {
+                if (!body[pc]) continue;
+
+                auto instruction = fetch(data, pc);
+                if (utils::get_nibble(instruction, 0) != 0x2) continue;
+
+                auto target = bodies.find(utils::get_addr(instruction) - ENTRY);
+                if (target != bodies.end())
+                    depth = std::max(depth, 1 + visit(target->first));
+            }
+
+            states[entry] = state::done;
+            return depths[entry] = depth;
+        };
+
+        auto depth = visit(0);
+        if (!bounded) return std::nullopt;
+
+        return depth;
+    }
+
+    /*
+     * Marks the rom offsets that start a basic block: the entrypoint, every
+     * target of a control transfer, the instruction following one and code
+     * that is not preceded by other code.
+     */
+    code_map find_leaders(const std::vector<uint8_t>& data, const code_map& code, const jump_map& jumps)
+    {
+        code_map leaders(data.size(), false);
+
+        for (size_t pc = 0; pc < code.size(); pc += 2)
+        {
+            if (!code[pc]) continue;
+
+            if (pc == 0 || !code[pc - 2])
+                leaders[pc] = true;
+
+            std::vector<size_t> successors;
+            for_each_successor(data, pc, [&](size_t succ) { successors.push_back(succ); }, jumps);
+
+            // a jump to the next instruction still ends its block
+            auto instruction = fetch(data, pc);
+            auto op = utils::get_nibble(instruction, 0);
+            auto jump = op == 0x1 || op == 0xb || (op == 0x0 && instruction != 0x00e0);
+            if (!jump && successors.size() == 1 && successors[0] == pc + 2) continue;
+
+            for (auto succ : successors)
+                leaders[succ] = code[succ];
+
+            if (pc + 2 < code.size())
+                leaders[pc + 2] = code[pc + 2];
+        }
+
+        return leaders;
+    }
+
+    /*
+     * Marks the targets of backward control transfers. Every cycle in the
+     * control flow contains at least one of them, so they are the only
+     * places where code can get hot.
+     */
+    code_map find_loop_headers(const std::vector<uint8_t>& data, const code_map& code, const jump_map& jumps)
+    {
+        code_map headers(data.size(), false);
+
+        for (size_t pc = 0; pc < code.size(); pc += 2)
+        {
+            if (!code[pc]) continue;
+
+            for_each_successor(data, pc, [&](size_t succ)
+            {
+                if (succ <= pc) headers[succ] = code[succ];
+            }, jumps);
+        }
+
+        return headers;
+    }
+
+    /*
+     * Loops that do nothing but poll the delay timer or a key, keyed by their
+     * header. The register is the x of the header instruction:
+     *   ld Vx, DT; se Vx, 0; jp header    waits until DT is 0
+     *   skp Vx; jp header                 waits until key Vx is down
+     *   sknp Vx; jp header                waits until key Vx is up
+     */
+    std::vector<idle> find_idle_loops(const std::vector<uint8_t>& data, const code_map& code)
+    {
+        std::vector<idle> loops(data.size(), idle::none);
+
+        for (size_t pc = 0; pc + 3 < code.size(); pc += 2)
+        {
+            if (!code[pc] || !code[pc + 2]) continue;
+
+            auto header = fetch(data, pc);
+            auto x = utils::get_nibble(header, 1);
+            auto back = 0x1000 | (ENTRY + pc);
+
+            if ((header & 0xf0ff) == 0xf007 && pc + 5 < code.size() && code[pc + 4])
+            {
+                if (fetch(data, pc + 2) == (0x3000 | (x << 8)) && fetch(data, pc + 4) == back)
+                    loops[pc] = idle::delay_timer;
+            }
+            else if ((header & 0xf0ff) == 0xe09e && fetch(data, pc + 2) == back)
+                loops[pc] = idle::key_down;
+            else if ((header & 0xf0ff) == 0xe0a1 && fetch(data, pc + 2) == back)
+                loops[pc] = idle::key_up;
+        }
+
+        return loops;
+    }
+
+    /*
+     * Applies `op` to every pair of values. Results with more than MAX_VALUES
+     * values are not tracked.
+     */
+    template<typename F>
+    value_set combine(const value_set& a, const value_set& b, F&& op)
+    {
+        if (!a || !b) return std::nullopt;
+
+        std::vector<uint16_t> values;
+        for (auto x : *a)
+        {
+            for (auto y : *b)
+                values.push_back(op(x, y));
+        }
+
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        if (values.size() > MAX_VALUES) return std::nullopt;
+
+        return values;
+    }
+
+    value_set join(const value_set& a, const value_set& b)
+    {
+        if (!a || !b) return std::nullopt;
+
+        std::vector<uint16_t> values;
+        std::set_union(a->begin(), a->end(), b->begin(), b->end(), std::back_inserter(values));
+        if (values.size() > MAX_VALUES) return std::nullopt;
+
+        return values;
+    }
+
+    // registers after the instruction, edges add what they know on top
+    register_sets transfer(uint16_t instruction, register_sets sets)
+    {
+        auto x = utils::get_nibble(instruction, 1);
+        auto byte = utils::get_byte(instruction, 0);
+        auto any = value_set{};
+
+        switch (utils::get_nibble(instruction, 0))
+        {
+        case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xb: case 0xe:
+            break;
+        case 0x6:
+            sets[x] = std::vector<uint16_t>{ byte };
+            break;
+        case 0x7:
+            sets[x] = combine(sets[x], value_set{ { byte } }, [](uint16_t a, uint16_t b) { return (a + b) & 0xff; });
+            break;
+        case 0xa:
+            sets[I] = std::vector<uint16_t>{ utils::get_addr(instruction) };
+            break;
+        case 0xc:
+        {
+            // rnd can only set the bits of its mask
+            std::vector<uint16_t> values;
+            for (uint16_t value = 0; value < 0x100; ++value)
+            {
+                if (!(value & ~byte)) values.push_back(value);
+            }
+            sets[x] = values.size() <= MAX_VALUES ? value_set{ values } : any;
+            break;
+        }
+        case 0xd:
+            sets[0xf] = any;
+            break;
+        case 0xf:
+            switch (byte)
+            {
+            case 0x15: case 0x18: case 0x33: case 0x55:
+                break;
+            case 0x1e:
+                sets[I] = combine(sets[I], sets[x], [](uint16_t a, uint16_t b) { return (a + b) & 0xffff; });
+                break;
+            case 0x65:
+                for (size_t n = 0; n <= x; ++n) sets[n] = any;
+                break;
+            case 0x07: case 0x0a:
+                sets[x] = any;
+                break;
+            default:
+                sets.fill(any);
+                break;
+            }
+            break;
+        case 0x8:
+        {
+            auto vx = sets[x];
+            auto vy = sets[utils::get_nibble(instruction, 2)];
+            auto unary = [&](auto op) { return combine(vx, value_set{ { 0 } }, [&](uint16_t a, uint16_t) { return op(a); }); };
+
+            // VF is written after Vx, the flag wins when x is F
+            switch (instruction & 0xf)
+            {
+            case 0x0:
+                sets[x] = vy;
+                break;
+            case 0x1:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return a | b; });
+                break;
+            case 0x2:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return a & b; });
+                break;
+            case 0x3:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return a ^ b; });
+                break;
+            case 0x4:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return (a + b) & 0xff; });
+                sets[0xf] = combine(vx, vy, [](uint16_t a, uint16_t b) { return (a + b) >> 8; });
+                break;
+            case 0x5:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return (a - b) & 0xff; });
+                sets[0xf] = combine(vx, vy, [](uint16_t a, uint16_t b) { return a >= b; });
+                break;
+            case 0x7:
+                sets[x] = combine(vx, vy, [](uint16_t a, uint16_t b) { return (b - a) & 0xff; });
+                sets[0xf] = combine(vx, vy, [](uint16_t a, uint16_t b) { return b >= a; });
+                break;
+            case 0x6:
+                sets[x] = unary([](uint16_t a) { return a >> 1; });
+                sets[0xf] = unary([](uint16_t a) { return a & 1; });
+                break;
+            case 0xe:
+                sets[x] = unary([](uint16_t a) { return (a << 1) & 0xff; });
+                sets[0xf] = unary([](uint16_t a) { return a >> 7; });
+                break;
+            default:
+                sets[x] = any;
+                break;
+            }
+            break;
+        }
+        }
+
+        return sets;
+    }
+
+    /*
+     * Abstract interpretation over the control flow that finds the values
+     * V0-VF and I may hold before every instruction. Everything is 0 at the
+     * entrypoint, a call may change every register and skips on a constant
+     * narrow the register they compare. A jp V0 that `jumps` does not resolve
+     * may reach every leader, which then knows nothing. Code that is never
+     * reached has no state.
+     */
+    state_map find_value_sets(const std::vector<uint8_t>& data, const code_map& code, const jump_map& jumps)
+    {
+        state_map states(data.size());
+        if (code.empty() || !code[0]) return states;
+
+        states[0].emplace();
+        states[0]->fill(std::vector<uint16_t>{ 0 });
+        std::vector<size_t> worklist{ 0 };
+        auto escaped = false;
+
+        auto merge = [&](size_t succ, const register_sets& next)
+        {
+            if (!states[succ])
+            {
+                states[succ] = next;
+                worklist.push_back(succ);
+                return;
+            }
+
+            auto changed = false;
+            for (size_t n = 0; n < next.size(); ++n)
+            {
+                auto joined = join((*states[succ])[n], next[n]);
+                if (joined == (*states[succ])[n]) continue;
+
+                (*states[succ])[n] = joined;
+                changed = true;
+            }
+
+            if (changed) worklist.push_back(succ);
+        };
+
+        while (!worklist.empty())
+        {
+            auto pc = worklist.back();
+            worklist.pop_back();
+
+            auto instruction = fetch(data, pc);
+            auto op = utils::get_nibble(instruction, 0);
+            auto x = utils::get_nibble(instruction, 1);
+            auto byte = utils::get_byte(instruction, 0);
+            auto sets = transfer(instruction, *states[pc]);
+
+            // the shared dispatcher can enter any leader
+            auto resolved = jumps.find(pc);
+            if (op == 0xb && resolved != jumps.end() && !resolved->second && !escaped)
+            {
+                escaped = true;
+
+                auto leaders = find_leaders(data, code, jumps);
+                for (size_t leader = 0; leader < leaders.size(); leader += 2)
+                {
+                    if (leaders[leader]) merge(leader, register_sets{});
+                }
+            }
+
+            for_each_successor(data, pc, [&](size_t succ)
+            {
+                if (!code[succ]) return;
+
+                auto next = sets;
+                if (op == 0x2 && succ == pc + 2)
+                    next.fill(std::nullopt);
+
+                // se Vx, kk takes the skip when Vx is kk, sne Vx, kk when it is not
+                if (op == 0x3 || op == 0x4)
+                {
+                    auto equal = (op == 0x3) == (succ == pc + 4);
+                    if (!next[x])
+                    {
+                        if (equal) next[x] = std::vector<uint16_t>{ byte };
+                    }
+                    else
+                    {
+                        auto& values = *next[x];
+                        values.erase(std::remove_if(values.begin(), values.end(), [&](uint16_t v) { return (v == byte) != equal; }), values.end());
+                        if (values.empty()) return;
+                    }
+                }
+
+                merge(succ, next);
+            }, jumps);
+        }
+
+        return states;
+    }
+
+    /*
+     * Targets of every jp V0 from the values V0 may hold there. The value sets
+     * depend on the targets, so both are refined until they agree. Targets
+     * only ever grow and a jump that was not resolved once stays that way.
+     */
+    jump_map find_jumps(const std::vector<uint8_t>& data, const code_map& code)
+    {
+        jump_map jumps;
+
+        for (auto changed = true; changed;)
+        {
+            changed = false;
+            auto states = find_value_sets(data, code, jumps);
+
+            for (size_t pc = 0; pc < code.size(); pc += 2)
+            {
+                auto instruction = fetch(data, pc);
+                if (!code[pc] || !states[pc] || utils::get_nibble(instruction, 0) != 0xb) continue;
+
+                auto known = jumps.find(pc);
+                if (known != jumps.end() && !known->second) continue;
+
+                std::optional<std::vector<size_t>> targets;
+                if (auto& v0 = (*states[pc])[0])
+                {
+                    targets.emplace(known != jumps.end() ? *known->second : std::vector<size_t>{});
+                    for (auto value : *v0)
+                    {
+                        size_t addr = utils::get_addr(instruction) + value;
+                        if (addr >= ENTRY && addr - ENTRY < data.size())
+                            targets->push_back(addr - ENTRY);
+                    }
+
+                    std::sort(targets->begin(), targets->end());
+                    targets->erase(std::unique(targets->begin(), targets->end()), targets->end());
+                }
+
+                if (known != jumps.end() && known->second == targets) continue;
+
+                jumps[pc] = targets;
+                changed = true;
+            }
+        }
+
+        return jumps;
+    }
+
+    /*
+     * Recursive descent over the control flow starting at the entrypoint.
+     * Every rom offset that starts a reachable instruction is marked as code,
+     * everything else is treated as data and never lifted. The targets the
+     * value sets resolve for jp V0 are followed until no new code turns up,
+     * `jumps` is left with the targets for the final code map.
+     */
+    code_map discover_code(const std::vector<uint8_t>& data, jump_map& jumps)
+    {
+        code_map code(data.size(), false);
+        descend(data, code, { 0 }, {});
+
+        for (auto grown = true; grown;)
+        {
+            jumps = find_jumps(data, code);
+
+            std::vector<size_t> targets;
+            for (auto& [pc, resolved] : jumps)
+            {
+                if (resolved) targets.insert(targets.end(), resolved->begin(), resolved->end());
+            }
+
+            auto before = code;
+            descend(data, code, targets, jumps);
+            grown = code != before;
+        }
+
+        return code;
+    }
+
+    // the value of register `n` before every instruction where it has only one
+    std::vector<std::optional<uint16_t>> find_constants(const state_map& states, size_t n)
+    {
+        std::vector<std::optional<uint16_t>> values(states.size());
+
+        for (size_t pc = 0; pc < states.size(); ++pc)
+        {
+            if (states[pc] && (*states[pc])[n] && (*states[pc])[n]->size() == 1)
+                values[pc] = (*states[pc])[n]->front();
+        }
+
+        return values;
+    }
+
+    /*
+     * Guest memory that ld B, Vx or ld [I], Vx may write. A single store through
+     * an I that is not known makes all of it writable.
+     */
+    std::vector<bool> find_written_memory(const std::vector<uint8_t>& data, const code_map& code, const state_map& states)
+    {
+        std::vector<bool> written(0x1000, false);
+
+        for (size_t pc = 0; pc < code.size(); pc += 2)
+        {
+            if (!code[pc]) continue;
+
+            auto instruction = fetch(data, pc);
+            size_t size = 0;
+            if ((instruction & 0xf0ff) == 0xf033) size = 3;
+            if ((instruction & 0xf0ff) == 0xf055) size = utils::get_nibble(instruction, 1) + 1;
+            if (!size) continue;
+
+            if (!states[pc] || !(*states[pc])[I])
+                return std::vector<bool>(0x1000, true);
+
+            for (auto i : *(*states[pc])[I])
+            {
+                for (size_t n = 0; n < size; ++n)
+                    written[(i + n) & 0xfff] = true;
+            }
+        }
+
+        return written;
+    }
+
+    struct flag_access
+    {
+        bool reads = false;
+        bool writes = false;
+    };
+
+    // whether an instruction reads VF and whether it overwrites it
+    flag_access access_flag(uint16_t instruction)
+    {
+        auto x = utils::get_nibble(instruction, 1) == 0xf;
+        auto y = utils::get_nibble(instruction, 2) == 0xf;
+
+        switch (utils::get_nibble(instruction, 0))
+        {
+        case 0x0: case 0x1: case 0x2: case 0xa: case 0xb:
+            return {};
+        case 0x3: case 0x4: case 0x7: case 0xe:
+            return { x, false };
+        case 0x5: case 0x9:
+            return { x || y, false };
+        case 0x6: case 0xc:
+            return { false, x };
+        case 0x8:
+            switch (instruction & 0xf)
+            {
+            case 0x0: return { y, x };
+            case 0x1: case 0x2: case 0x3: return { x || y, x };
+            case 0x4: case 0x5: case 0x7: return { x || y, true };
+            case 0x6: case 0xe: return { x, true };
+            }
+            break;
+        case 0xd:
+            return { x || y, true };
+        case 0xf:
+            switch (instruction & 0xff)
+            {
+            case 0x07: case 0x0a: case 0x65: return { false, x };
+            case 0x15: case 0x18: case 0x1e: case 0x29: case 0x33: case 0x55: return { x, false };
+            }
+            break;
+        }
+
+        // nothing is known about the rest
+        return { true, false };
+    }
+
+    /*
+     * Instructions after which VF may be read before it is overwritten. The
+     * carry, borrow and shifted out bit of the other instructions are never
+     * observed and do not need to be computed. VF stays live across calls,
+     * returns, jp V0 and anything that leaves the code.
+     */
+    code_map find_live_flags(const std::vector<uint8_t>& data, const code_map& code)
+    {
+        code_map live_in(code.size(), false);
+        code_map live_out(code.size(), false);
+
+        for (auto changed = true; changed;)
+        {
+            changed = false;
+
+            for (auto pc = code.size() & ~size_t(1); pc > 0;)
+            {
+                pc -= 2;
+                if (!code[pc]) continue;
+
+                auto instruction = fetch(data, pc);
+                auto op = utils::get_nibble(instruction, 0);
+                auto out = instruction == 0x00ee || op == 0x2 || op == 0xb;
+                auto successors = 0;
+                for_each_successor(data, pc, [&](size_t succ)
+                {
+                    successors++;
+                    out = out || !code[succ] || live_in[succ];
+                });
+                out = out || !successors;
+
+                auto access = access_flag(instruction);
+                auto in = access.reads || (out && !access.writes);
+                if (in == live_in[pc] && out == live_out[pc]) continue;
+
+                live_in[pc] = in;
+                live_out[pc] = out;
+                changed = true;
+            }
+        }
+
+        return live_out;
+    }
+
+    // parses the "0-88,90-100" format of --code
+    std::vector<std::pair<size_t, size_t>> parse_ranges(const std::string& value)
+    {
+        std::vector<std::pair<size_t, size_t>> code_blocks;
+        for (auto& range : utils::split(value, ","))
+        {
+            auto bounds = utils::split(range, "-");
+            auto start = atoi(bounds[0].c_str());
+            code_blocks.push_back(std::make_pair(start, bounds.size() > 1 ? atoi(bounds[1].c_str()) : start));
+        }
+
+        return code_blocks;
+    }
+
+    code_map from_ranges(const std::vector<uint8_t>& data, const std::vector<std::pair<size_t, size_t>>& code_blocks)
+    {
+        code_map code(data.size(), false);
+
+        for (auto& [start, end] : code_blocks)
+        {
+            for (size_t pc = start + start % 2; pc <= end && pc + 1 < data.size(); pc += 2)
+                code[pc] = true;
+        }
+
+        return code;
+    }
+
+    // formats the map the same way --code expects it
+    std::string to_ranges(const code_map& code)
+    {
+        std::string ranges;
+
+        for (size_t pc = 0; pc < code.size(); pc += 2)
+        {
+            if (!code[pc]) continue;
+
+            auto end = pc;
+            while (end + 2 < code.size() && code[end + 2]) end += 2;
+
+            if (!ranges.empty()) ranges += ",";
+            ranges += utils::fmt("%zu-%zu", pc, end + 1);
+            pc = end;
+        }
+
+        return ranges;
+    }
+}
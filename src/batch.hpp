@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+
+#include "analysis.hpp"
+#include "utils.hpp"
+
+namespace batch
+{
+    struct job
+    {
+        std::filesystem::path rom;
+        std::optional<std::vector<std::pair<size_t, size_t>>> code_blocks{};
+        // file name the artifacts are derived from, unique within the batch
+        std::filesystem::path name{};
+    };
+
+    // roms that share a file name are told apart by their position in the batch
+    void name_jobs(std::vector<job>& jobs)
+    {
+        std::map<std::filesystem::path, size_t> count;
+        for (auto& entry : jobs)
+            count[entry.rom.filename()]++;
+
+        for (size_t n = 0; n < jobs.size(); ++n)
+        {
+            auto file = jobs[n].rom.filename();
+            jobs[n].name = count[file] > 1 ? std::to_string(n) + "-" + file.string() : file.string();
+        }
+    }
+
+    /*
+     * Collects the jobs from a directory of *.ch8 files or from a manifest
+     * with one "path [code]" per line, where path is relative to the manifest
+     * and code uses the --code format. Empty lines and # comments are skipped.
+     */
+    std::vector<job> load(const std::filesystem::path& path)
+    {
+        std::vector<job> jobs;
+
+        if (std::filesystem::is_directory(path))
+        {
+            for (auto& entry : std::filesystem::directory_iterator(path))
+            {
+                if (entry.is_regular_file() && entry.path().extension() == ".ch8")
+                    jobs.push_back({ entry.path() });
+            }
+
+            std::sort(jobs.begin(), jobs.end(), [](auto& a, auto& b) { return a.rom < b.rom; });
+            name_jobs(jobs);
+            return jobs;
+        }
+
+        std::ifstream manifest(path);
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            line = line.substr(0, line.find('#'));
+
+            auto fields = utils::split(line, " ");
+            fields.erase(std::remove(fields.begin(), fields.end(), ""), fields.end());
+            if (fields.empty()) continue;
+
+            job entry{ path.parent_path() / fields[0] };
+            if (fields.size() > 1)
+                entry.code_blocks = analysis::parse_ranges(fields[1]);
+            jobs.push_back(entry);
+        }
+
+        name_jobs(jobs);
+        return jobs;
+    }
+
+    /*
+     * Runs `compile` for every job on `threads` workers. Each worker claims the
+     * next job from a shared cursor, so a few large roms do not hold up a
+     * worker that still has a queue of small ones.
+     */
+    template<typename F>
+    bool run(const std::vector<job>& jobs, size_t threads, F&& compile)
+    {
+        using clock = std::chrono::steady_clock;
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        if (jobs.empty())
+        {
+            printf("No ROMs found\n");
+            return false;
+        }
+
+        std::atomic<size_t> cursor{ 0 };
+        std::atomic<size_t> failed{ 0 };
+        std::atomic<size_t> bytes{ 0 };
+        std::mutex output;
+
+        auto worker = [&]()
+        {
+            utils::listing = false;
+
+            for (size_t n; (n = cursor++) < jobs.size();)
+            {
+                auto start = clock::now();
+                std::error_code error;
+                auto size = std::filesystem::file_size(jobs[n].rom, error);
+                auto ok = !error && compile(jobs[n]);
+                auto elapsed = milliseconds(clock::now() - start).count();
+
+                if (error) size = 0;
+                bytes += size;
+                if (!ok) failed++;
+
+                std::lock_guard lock(output);
+                printf("%-32s %6zu bytes %8.1f ms%s\n", jobs[n].name.string().c_str(), (size_t)size, elapsed, ok ? "" : " FAILED");
+            }
+        };
+
+        auto start = clock::now();
+
+        std::vector<std::thread> workers;
+        for (size_t n = 0; n < std::min(threads, jobs.size()); ++n)
+            workers.emplace_back(worker);
+        for (auto& thread : workers)
+            thread.join();
+
+        auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+        printf("\n%zu roms (%zu failed) on %zu threads in %.2f s: %.1f roms/s, %.1f KiB/s\n",
+            jobs.size(), failed.load(), workers.size(), seconds, jobs.size() / seconds, bytes / 1024.0 / seconds);
+
+        return failed == 0;
+    }
+}
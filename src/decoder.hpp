@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "instructions.hpp"
+
+namespace decoder
+{
+    struct pattern
+    {
+        uint16_t value;
+        uint16_t mask;
+        instruction_t handler;
+    };
+
+    constexpr pattern PATTERNS[] =
+    {
+        { 0x00e0, 0xffff, instruction::cls },
+        { 0x00ee, 0xffff, instruction::ret },
+        { 0xf055, 0xf0ff, instruction::ld_i_vx },
+        { 0xf065, 0xf0ff, instruction::ld_vx_i },
+        { 0xf033, 0xf0ff, instruction::ld_b_vx },
+        { 0xf01e, 0xf0ff, instruction::add_i_vx },
+        { 0xf007, 0xf0ff, instruction::ld_vx_dt },
+        { 0xf00a, 0xf0ff, instruction::ld_vx_k },
+        { 0xf015, 0xf0ff, instruction::ld_dt_vx },
+        { 0xf018, 0xf0ff, instruction::ld_st_vx },
+        { 0x0000, 0xf000, instruction::sys },
+        { 0x1000, 0xf000, instruction::jp },
+        { 0xb000, 0xf000, instruction::jp_rel },
+        { 0xa000, 0xf000, instruction::ld_i },
+        { 0x6000, 0xf000, instruction::ld_reg },
+        { 0x3000, 0xf000, instruction::se },
+        { 0x4000, 0xf000, instruction::sne },
+        { 0x5000, 0xf00f, instruction::se_v_v },
+        { 0x9000, 0xf00f, instruction::sne_v_v },
+        { 0xc000, 0xf000, instruction::rnd },
+        { 0xd000, 0xf000, instruction::drw },
+        { 0x2000, 0xf000, instruction::call },
+        { 0x7000, 0xf000, instruction::add },
+        { 0xe09e, 0xf0ff, instruction::skp },
+        { 0xe0a1, 0xf0ff, instruction::sknp },
+        { 0x8000, 0xf00f, instruction::ld_v_v },
+        { 0x8001, 0xf00f, instruction::or_v_v },
+        { 0x8002, 0xf00f, instruction::and_v_v },
+        { 0x8003, 0xf00f, instruction::xor_v_v },
+        { 0x8004, 0xf00f, instruction::add_v_v },
+        { 0x8005, 0xf00f, instruction::sub },
+        { 0x8006, 0xf00f, instruction::shr },
+        { 0x8007, 0xf00f, instruction::subn },
+        { 0x800e, 0xf00f, instruction::shl }
+    };
+
+    /*
+     * Apart from cls and ret no CHIP8 opcode is distinguished by its middle
+     * nibble, so the top nibble and the low byte select the handler. The exact
+     * patterns are matched by decode() before the table is consulted.
+     */
+    constexpr size_t key(uint16_t opcode)
+    {
+        return ((opcode >> 4) & 0xf00) | (opcode & 0xff);
+    }
+
+    constexpr auto TABLE = []
+    {
+        std::array<instruction_t, 0x1000> table{};
+
+        // less specific masks go first so that more specific patterns override them
+        for (uint16_t mask : { 0xf000, 0xf00f, 0xf0ff })
+        {
+            for (auto& pattern : PATTERNS)
+            {
+                if (pattern.mask != mask) continue;
+
+                for (uint16_t low = 0; low < 0x100; ++low)
+                {
+                    if ((low & mask & 0xff) == (pattern.value & 0xff))
+                        table[key((pattern.value & 0xf000) | low)] = pattern.handler;
+                }
+            }
+        }
+
+        return table;
+    }();
+
+    constexpr instruction_t decode(uint16_t opcode)
+    {
+        // 0nnn with a middle nibble other than zero is sys, not cls or ret
+        for (auto& pattern : PATTERNS)
+        {
+            if (pattern.mask == 0xffff && pattern.value == opcode)
+                return pattern.handler;
+        }
+
+        return TABLE[key(opcode)];
+    }
+
+    constexpr bool is_reachable()
+    {
+        for (auto& pattern : PATTERNS)
+        {
+            if ((pattern.value & pattern.mask) != pattern.value) return false;
+            if (pattern.mask != 0xffff && (pattern.mask & 0x0f00)) return false;
+            if (decode(pattern.value) != pattern.handler) return false;
+        }
+
+        return true;
+    }
+
+    static_assert(is_reachable(), "every pattern must be encodable and must not be shadowed by another one");
+    static_assert(decode(0x01e0) == instruction::sys && decode(0x0fee) == instruction::sys, "cls and ret only match exactly");
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <string>
+#include <memory>
+#include <optional>
+#include <filesystem>
+#include <unordered_map>
+
+using namespace llvm;
+
+namespace emitter
+{
+    enum class kind { ir, bitcode, assembly, object, executable };
+
+    std::optional<kind> parse_kind(const std::string& name)
+    {
+        static const std::unordered_map<std::string, kind> KINDS =
+        {
+            { "ll", kind::ir },
+            { "bc", kind::bitcode },
+            { "asm", kind::assembly },
+            { "obj", kind::object },
+            { "exe", kind::executable }
+        };
+
+        auto found = KINDS.find(name);
+        if (found == KINDS.end()) return std::nullopt;
+
+        return found->second;
+    }
+
+    // boot.ch8 becomes boot.ch8.ll, boot.ch8.o or boot
+    std::string output_path(const std::filesystem::path& rom, kind type)
+    {
+        auto name = rom.filename().string();
+
+        switch (type)
+        {
+        case kind::ir: return name + ".ll";
+        case kind::bitcode: return name + ".bc";
+        case kind::assembly: return name + ".s";
+        #ifdef _WIN32
+        case kind::object: return name + ".obj";
+        case kind::executable: return rom.stem().string() + ".exe";
+        #else
+        case kind::object: return name + ".o";
+        case kind::executable: return rom.stem().string();
+        #endif
+        }
+
+        return name;
+    }
+
+    std::unique_ptr<TargetMachine> create_target_machine(std::string& error)
+    {
+        auto triple = sys::getDefaultTargetTriple();
+        auto target = TargetRegistry::lookupTarget(triple, error);
+        if (!target) return nullptr;
+
+        return std::unique_ptr<TargetMachine>(target->createTargetMachine(triple, "generic", "", TargetOptions(), Reloc::PIC_));
+    }
+
+    bool compile(Module& program, raw_pwrite_stream& output, CodeGenFileType type)
+    {
+        std::string error;
+        auto machine = create_target_machine(error);
+        if (!machine)
+        {
+            printf("Emission error: %s\n", error.c_str());
+            return false;
+        }
+
+        program.setTargetTriple(machine->getTargetTriple().str());
+        program.setDataLayout(machine->createDataLayout());
+
+        legacy::PassManager passes;
+        if (machine->addPassesToEmitFile(passes, output, nullptr, type))
+        {
+            printf("Emission error: %s can not emit this file type\n", machine->getTargetTriple().str().c_str());
+            return false;
+        }
+
+        passes.run(program);
+        output.flush();
+        return true;
+    }
+
+    // links the object against the runtime with the system compiler driver
+    bool link(const std::string& object, const std::string& path)
+    {
+        auto driver = sys::findProgramByName("c++");
+        if (!driver) driver = sys::findProgramByName("clang++");
+        if (!driver)
+        {
+            printf("Emission error: no c++ or clang++ in PATH to link with\n");
+            return false;
+        }
+
+        std::vector<StringRef> args{ *driver, object, LLVM8_RUNTIME, "-o", path };
+        #ifndef _WIN32
+        args.insert(args.end(), { "-lpthread", "-ldl" });
+        #endif
+
+        std::string error;
+        if (sys::ExecuteAndWait(*driver, args, None, {}, 0, 0, &error) != 0)
+        {
+            printf("Emission error: linking %s failed %s\n", path.c_str(), error.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * Writes the module to `path` as textual IR, bitcode, assembly, an object
+     * file or an executable that is linked against the runtime. Code generation
+     * uses the host target.
+     */
+    bool emit(Module& program, kind type, const std::string& path)
+    {
+        if (type == kind::executable)
+        {
+            SmallString<128> object;
+            if (sys::fs::createTemporaryFile("llvm8", "o", object))
+            {
+                printf("Emission error: can not create a temporary object file\n");
+                return false;
+            }
+
+            auto linked = emit(program, kind::object, object.str().str()) && link(object.str().str(), path);
+            sys::fs::remove(object);
+            return linked;
+        }
+
+        std::error_code code;
+        auto text = type == kind::ir || type == kind::assembly;
+        raw_fd_ostream output(path, code, text ? sys::fs::OF_Text : sys::fs::OF_None);
+        if (code)
+        {
+            printf("Emission error: %s: %s\n", path.c_str(), code.message().c_str());
+            return false;
+        }
+
+        switch (type)
+        {
+        case kind::ir:
+            program.print(output, nullptr);
+            return true;
+        case kind::bitcode:
+            WriteBitcodeToFile(program, output);
+            return true;
+        case kind::assembly:
+            return compile(program, output, CGFT_AssemblyFile);
+        default:
+            return compile(program, output, CGFT_ObjectFile);
+        }
+    }
+}
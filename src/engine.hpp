@@ -0,0 +1,246 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Interpreter.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "optimizer.hpp"
+#include "../external/lib.hpp"
+
+using namespace llvm;
+
+namespace engine
+{
+    using screen_t = std::array<uint64_t, 32>;
+    using memory_t = std::array<uint8_t, 4096>;
+    using resume_t = void(uint16_t);
+
+    using symbol_list = std::vector<std::pair<const char*, void*>>;
+
+    // runtime functions and state from external/lib.cpp that lifted code uses
+    const symbol_list RUNTIME =
+    {
+        { "init", (void*)&init },
+        { "get_delay_timer", (void*)&get_delay_timer },
+        { "set_delay_timer", (void*)&set_delay_timer },
+        { "get_sound_timer", (void*)&get_sound_timer },
+        { "set_sound_timer", (void*)&set_sound_timer },
+        { "wait_key", (void*)&wait_key },
+        { "wait_delay_timer", (void*)&wait_delay_timer },
+        { "wait_keypad", (void*)&wait_keypad },
+        { "set_clock", (void*)&set_clock },
+        { "yield_frame", (void*)&yield_frame },
+        { "unknown_jump", (void*)&unknown_jump },
+        { "unknown_call", (void*)&unknown_call },
+        { "keypad", (void*)&keypad },
+        { "draw", (void*)&draw }
+    };
+
+    void initialize()
+    {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        InitializeNativeTargetAsmParser();
+    }
+
+    void dump_state(const std::vector<uint8_t>& data, const memory_t* memory, const screen_t* screen)
+    {
+        if (!memory || !screen)
+        {
+            printf("Guest state is not available\n");
+            return;
+        }
+
+        printf("ROM: ");
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            printf("%02x ", (*memory)[0x200 + i]);
+        }
+        printf("\n");
+
+        for (auto row : *screen)
+        {
+            printf("%016llx\n", (unsigned long long)row);
+        }
+    }
+
+    template<typename T>
+    T* lookup(orc::LLJIT& jit, const std::string& name)
+    {
+        auto symbol = jit.lookup(name);
+        if (!symbol)
+        {
+            logAllUnhandledErrors(symbol.takeError(), errs(), "Lookup error: ");
+            return nullptr;
+        }
+
+        return jitTargetAddressToPointer<T*>(symbol->getAddress());
+    }
+
+    // LLJIT that resolves `symbols` in-process and everything else from the C runtime
+    std::unique_ptr<orc::LLJIT> create_jit(const symbol_list& symbols)
+    {
+        auto jit = orc::LLJITBuilder().create();
+        if (!jit)
+        {
+            logAllUnhandledErrors(jit.takeError(), errs(), "Execution error: ");
+            return nullptr;
+        }
+
+        auto& dylib = (*jit)->getMainJITDylib();
+        auto& layout = (*jit)->getDataLayout();
+
+        orc::MangleAndInterner mangle((*jit)->getExecutionSession(), layout);
+        orc::SymbolMap runtime;
+        for (auto& [name, address] : symbols)
+            runtime[mangle(name)] = JITEvaluatedSymbol(pointerToJITTargetAddress(address), JITSymbolFlags::Exported);
+        cantFail(dylib.define(orc::absoluteSymbols(std::move(runtime))));
+
+        // rand, srand, time and printf come from the C runtime of this process
+        dylib.addGenerator(cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(layout.getGlobalPrefix())));
+
+        return std::move(*jit);
+    }
+
+    bool add_module(orc::LLJIT& jit, orc::ThreadSafeModule program)
+    {
+        if (auto error = jit.addIRModule(std::move(program)))
+        {
+            logAllUnhandledErrors(std::move(error), errs(), "Execution error: ");
+            return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * Compiles the module to native code with ORC and runs main on the calling
+     * thread. The module is owned by the JIT from here on and is released as
+     * soon as its object code has been emitted.
+     */
+    void jit(std::unique_ptr<Module> program, std::unique_ptr<LLVMContext> context, const std::vector<uint8_t>& data)
+    {
+        auto jit = create_jit(RUNTIME);
+        if (!jit || !add_module(*jit, orc::ThreadSafeModule(std::move(program), std::move(context)))) return;
+
+        auto main = lookup<void()>(*jit, "main");
+        if (!main) return;
+
+        main();
+
+        dump_state(data, lookup<memory_t>(*jit, "memory"), lookup<screen_t>(*jit, "screen"));
+    }
+
+    // resume() waiting to be optimized and compiled once tier 0 got hot
+    struct pending_tier
+    {
+        orc::LLJIT* jit = nullptr;
+        orc::ThreadSafeModule program;
+        PassBuilder::OptimizationLevel level = PassBuilder::OptimizationLevel::O2;
+        std::string passes;
+        std::atomic<resume_t*>* target = nullptr;
+        std::once_flag requested;
+        std::thread compiler;
+    };
+
+    pending_tier tier1;
+
+    static_assert(sizeof(std::atomic<resume_t*>) == sizeof(resume_t*) && std::atomic<resume_t*>::is_always_lock_free,
+        "tier 0 reads the tier1 global as a plain pointer");
+
+    void compile_tier1()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        if (!optimizer::run(*tier1.program.getModuleUnlocked(), tier1.level, tier1.passes)) return;
+        if (!add_module(*tier1.jit, std::move(tier1.program))) return;
+
+        auto resume = lookup<resume_t>(*tier1.jit, "resume");
+        if (!resume) return;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        printf("Tier 1 ready after %lld ms\n", (long long)elapsed.count());
+
+        tier1.target->store(resume, std::memory_order_release);
+    }
+
+    // called by tier 0 whenever a loop header crosses the threshold
+    void tier_up()
+    {
+        std::call_once(tier1.requested, [] { tier1.compiler = std::thread(compile_tier1); });
+    }
+
+    /*
+     * Starts main right away as unoptimized tier 0 code. `resume` is only
+     * optimized and compiled on a background thread once tier 0 requests it,
+     * tier 0 then continues in it at the next loop header. Both tiers share
+     * the guest state, which tier 0 defines and tier 1 declares.
+     */
+    void tiered(std::unique_ptr<Module> program, std::unique_ptr<LLVMContext> context, orc::ThreadSafeModule resume,
+        PassBuilder::OptimizationLevel level, const std::string& passes, const std::vector<uint8_t>& data)
+    {
+        auto symbols = RUNTIME;
+        symbols.emplace_back("tier_up", (void*)&tier_up);
+
+        auto jit = create_jit(symbols);
+        if (!jit || !add_module(*jit, orc::ThreadSafeModule(std::move(program), std::move(context)))) return;
+
+        tier1.jit = jit.get();
+        tier1.program = std::move(resume);
+        tier1.level = level;
+        tier1.passes = passes;
+        tier1.target = lookup<std::atomic<resume_t*>>(*jit, "tier1");
+
+        auto main = lookup<void()>(*jit, "main");
+        if (!main || !tier1.target) return;
+
+        main();
+
+        if (tier1.compiler.joinable())
+            tier1.compiler.join();
+
+        dump_state(data, lookup<memory_t>(*jit, "memory"), lookup<screen_t>(*jit, "screen"));
+    }
+
+    void interpret(std::unique_ptr<Module> program, const std::vector<uint8_t>& data)
+    {
+        // only resolvable if the interpreter was built with libffi
+        for (auto& [name, address] : RUNTIME)
+            sys::DynamicLibrary::AddSymbol(name, address);
+
+        auto main = program->getFunction("main");
+
+        std::string error;
+        std::unique_ptr<ExecutionEngine> vm(EngineBuilder(std::move(program))
+            .setErrorStr(&error)
+            .setEngineKind(EngineKind::Interpreter)
+            .create());
+
+        if (!vm)
+        {
+            printf("Execution error: %s\n", error.c_str());
+            return;
+        }
+
+        vm->finalizeObject();
+        vm->runFunction(main, { });
+
+        auto screen = (screen_t*)vm->getAddressToGlobalIfAvailable("screen");
+        auto memory = (memory_t*)vm->getAddressToGlobalIfAvailable("memory");
+        dump_state(data, memory, screen);
+    }
+}
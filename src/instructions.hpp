@@ -2,13 +2,19 @@
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/NoFolder.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/Interpreter.h>
 #include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Intrinsics.h>
 
+#include <array>
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+#include "analysis.hpp"
 #include "utils.hpp"
 
 using namespace llvm;
@@ -29,75 +35,527 @@ struct instruction_info
     auto byte() { return get_byte(instruction, N); }
 
     auto addr() { return get_addr(instruction); }
+
+    // guest address of the n-th instruction after this one
+    size_t next(size_t n = 1) { return 0x200 + address + 2 * n; }
+};
+
+struct lift_options
+{
+    bool debug_names = false;
+    bool promote_registers = false;
+
+    // tier 0: count loop header executions and hand over to tier 1 once it is ready
+    bool tier_up = false;
+    uint32_t tier_up_threshold = 1000;
+
+    // tier 1: lift into resume(pc) which continues at any block leader
+    bool resume = false;
+
+    // always inline the shared drw_N helpers instead of leaving it to the inliner
+    bool inline_drw = false;
+
+    // guest instructions per second, 0 runs at host speed
+    uint32_t clock_hz = 0;
+
+    // DT and ST follow the retired instructions instead of the wall clock
+    bool virtual_time = false;
 };
 
+// native function of every routine by its address
+using routine_map = std::array<Function*, 0x1000>;
+
 struct context_info
 {
     Module& program;
-    IRBuilder<NoFolder>& builder;
-    std::unordered_map<uint16_t, BasicBlock*> basic_blocks;
-    std::unordered_map<uint16_t, Instruction*> instructions;
-    BasicBlock* skippable = nullptr;
+    IRBuilder<>& builder;
+    lift_options options;
+    std::array<BasicBlock*, 0x1000> blocks{};
+    BasicBlock* exit = nullptr;
+    PHINode* jump_target = nullptr;
+
+    // rom offsets the dispatcher may enter, the value sets assume a jp V0 they did not resolve reaches any of them
+    analysis::code_map dispatch_targets{};
+
+    // values the registers may hold before the current instruction and I if it has only one
+    analysis::register_sets values{};
+    std::optional<uint16_t> constant_i{};
+
+    // whether VF may be read after the current instruction before it is overwritten
+    bool flag_live = true;
+
+    // guest memory that never changes at runtime
+    std::array<std::optional<uint8_t>, 0x1000> constant_memory{};
+
+    // calls either call the routine natively or push to the guest stack, then ret switches over the return sites
+    routine_map routines{};
+    bool guest_stack = false;
+    std::vector<uint16_t> return_sites{};
+
+    // V0-VF followed by I, either their slots in the register file and I or function-local copies of them
+    std::array<Value*, 17> globals{};
+    std::array<Value*, 17> registers{};
 
     auto ctx() { return std::tie(program, builder); }
-};
 
-using instruction_t = void(*)(instruction_info&, context_info&);
+    Value* v(size_t n) { return registers[n]; }
+    Value* i() { return registers[16]; }
 
-struct instruction
-{
-    static void jp(instruction_info& info, context_info& context)
+    // carry, borrow and shifted out bits are only stored where they are observed
+    template<typename F>
+    void set_flag(F&& flag)
     {
-        auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("jp 0x%x", info.addr()));
-        context.instructions[info.address] = instr;
+        if (flag_live)
+            builder.CreateStore(builder.CreateZExt(flag(), builder.getInt8Ty()), v(0xf));
+    }
+
+    Type* register_type(size_t n) { return n < 16 ? builder.getInt8Ty() : builder.getInt16Ty(); }
+
+    void init_registers()
+    {
+        auto file = program.getNamedGlobal("V");
+        for (size_t n = 0; n < 16; ++n)
+            globals[n] = builder.CreateConstInBoundsGEP2_64(file->getValueType(), file, 0, n);
+        globals[16] = program.getNamedGlobal("I");
+
+        std::copy(globals.begin(), globals.end(), registers.begin());
+
+        if (!options.promote_registers) return;
+
+        // mem2reg turns these into SSA values once the function is complete
+        for (size_t n = 0; n < globals.size(); ++n)
+        {
+            auto type = register_type(n);
+            registers[n] = builder.CreateAlloca(type, nullptr, n < 16 ? fmt("V%x", n) : "I");
+            builder.CreateStore(builder.CreateLoad(type, globals[n]), registers[n]);
+        }
+    }
+
+    // makes the guest registers visible to code outside of the lifted function
+    void sync_registers()
+    {
+        if (!options.promote_registers) return;
+
+        for (size_t n = 0; n < globals.size(); ++n)
+            builder.CreateStore(builder.CreateLoad(register_type(n), registers[n]), globals[n]);
+    }
+
+    // picks up the guest registers that code outside of the lifted function changed
+    void reload_registers()
+    {
+        if (!options.promote_registers) return;
+
+        for (size_t n = 0; n < globals.size(); ++n)
+            builder.CreateStore(builder.CreateLoad(register_type(n), globals[n]), registers[n]);
+    }
+
+    // slot of the guest stack that `sp` points at
+    Value* stack_slot(Value* sp)
+    {
+        auto stack = program.getNamedGlobal("stack");
+        return builder.CreateInBoundsGEP(stack->getValueType(), stack, { builder.getInt64(0), builder.CreateZExt(sp, builder.getInt64Ty()) });
+    }
+
+    BasicBlock* exit_block()
+    {
+        if (!exit)
+        {
+            IRBuilderBase::InsertPointGuard guard(builder);
+
+            exit = BasicBlock::Create(program.getContext(), options.debug_names ? "exit" : "", builder.GetInsertBlock()->getParent());
+            builder.SetInsertPoint(exit);
+            sync_registers();
+            builder.CreateRetVoid();
+        }
+
+        return exit;
+    }
+
+    /*
+     * Emits the tier 0 check at the start of the loop header at `addr`. Once
+     * the header got hot the tier 1 compilation is requested, as soon as it
+     * is published execution continues in tier 1 and never comes back.
+     */
+    void tier_up(size_t addr)
+    {
+        auto& context = program.getContext();
+        auto func = builder.GetInsertBlock()->getParent();
+        auto counters = program.getNamedGlobal("counters");
+        auto tier1 = program.getNamedGlobal("tier1");
+
+        auto request = BasicBlock::Create(context, "", func);
+        auto check = BasicBlock::Create(context, "", func);
+        auto handover = BasicBlock::Create(context, "", func);
+        auto body = BasicBlock::Create(context, "", func);
+
+        auto counter = builder.CreateInBoundsGEP(counters->getValueType(), counters, { builder.getInt64(0), builder.getInt64(addr) });
+        auto count = builder.CreateAdd(builder.CreateLoad(builder.getInt32Ty(), counter), builder.getInt32(1));
+        builder.CreateStore(count, counter);
+        builder.CreateCondBr(builder.CreateICmpEQ(count, builder.getInt32(options.tier_up_threshold)), request, check);
+
+        builder.SetInsertPoint(request);
+        builder.CreateCall(program.getFunction("tier_up"));
+        builder.CreateBr(check);
+
+        builder.SetInsertPoint(check);
+        auto target = builder.CreateAlignedLoad(tier1->getValueType(), tier1, MaybeAlign(sizeof(void*)));
+        target->setAtomic(AtomicOrdering::Acquire);
+        builder.CreateCondBr(builder.CreateIsNotNull(target), handover, body);
+
+        // tier 1 writes the globals back itself when it returns
+        builder.SetInsertPoint(handover);
+        sync_registers();
+        auto type = FunctionType::get(builder.getVoidTy(), { builder.getInt16Ty() }, false);
+        builder.CreateCall(type, target, { builder.getInt16(addr) });
+        builder.CreateRetVoid();
+
+        builder.SetInsertPoint(body);
+    }
+
+    /*
+     * Charges the `count` instructions of the block starting here to the
+     * budget. Once it is used up the runtime grants the next slice, after
+     * sleeping until it is due unless the guest runs on virtual time.
+     */
+    void pace(size_t count)
+    {
+        auto& context = program.getContext();
+        auto func = builder.GetInsertBlock()->getParent();
+        auto budget = program.getNamedGlobal("budget");
+
+        auto yield = BasicBlock::Create(context, "", func);
+        auto body = BasicBlock::Create(context, "", func);
+
+        auto left = builder.CreateSub(builder.CreateLoad(builder.getInt32Ty(), budget), builder.getInt32(count));
+        builder.CreateStore(left, budget);
+        builder.CreateCondBr(builder.CreateICmpSLT(left, builder.getInt32(0)), yield, body);
+
+        builder.SetInsertPoint(yield);
+        auto slice = builder.CreateCall(program.getFunction("yield_frame"));
+        builder.CreateStore(builder.CreateAdd(left, slice), budget);
+        builder.CreateBr(body);
+
+        builder.SetInsertPoint(body);
+    }
 
-        auto main = program.getFunction("main");
-        
-        auto phys_addr = info.addr() - 0x200;
-        auto dst_block = utils::find_block(main->getBasicBlockList(), fmt("%x", phys_addr));
-        
-        if (!dst_block && phys_addr > info.address)
+    // hands the screen and the rows that changed since the last call to the runtime
+    void present()
+    {
+        sync_registers();
+
+        auto screen = program.getNamedGlobal("screen");
+        auto dirty = program.getNamedGlobal("dirty");
+        auto buff = builder.CreateInBoundsGEP(screen->getValueType(), screen, { builder.getInt64(0), builder.getInt64(0) });
+        builder.CreateCall(program.getFunction("draw"), { buff, builder.CreateLoad(builder.getInt32Ty(), dirty) });
+        builder.CreateStore(builder.getInt32(0), dirty);
+    }
+
+    // i1 that is set while the key in Vx is held, a single relaxed load of the runtime keypad
+    Value* key_down(size_t reg)
+    {
+        auto keypad = program.getNamedGlobal("keypad");
+        auto keys = builder.CreateAlignedLoad(builder.getInt16Ty(), keypad, MaybeAlign(2));
+        keys->setAtomic(AtomicOrdering::Monotonic);
+
+        auto key = builder.CreateAnd(builder.CreateLoad(builder.getInt8Ty(), v(reg)), 0xf);
+        auto bit = builder.CreateShl(builder.getInt16(1), builder.CreateZExt(key, builder.getInt16Ty()));
+        return builder.CreateICmpNE(builder.CreateAnd(keys, bit), builder.getInt16(0));
+    }
+
+    /*
+     * Blocks in the runtime until the idle loop that starts here would exit.
+     * The loop is still lifted as is and runs one last time afterwards.
+     */
+    void wait(analysis::idle loop, size_t reg)
+    {
+        if (loop == analysis::idle::delay_timer)
         {
-            context.basic_blocks[phys_addr] = &main->back();
+            builder.CreateCall(program.getFunction("wait_delay_timer"));
+            return;
         }
-        else if (!dst_block && phys_addr < info.address)
+
+        auto key = builder.CreateLoad(builder.getInt8Ty(), v(reg));
+        auto held = builder.getInt8(loop == analysis::idle::key_down);
+        builder.CreateCall(program.getFunction("wait_keypad"), { key, held });
+    }
+
+    // whether every value I may hold stays inside memory for `span` bytes
+    bool in_bounds(size_t span)
+    {
+        auto& i = values[analysis::I];
+        return i && std::all_of(i->begin(), i->end(), [&](uint16_t value) { return value + span <= 0x1000; });
+    }
+
+    // memory at I + offset, guest addresses wrap at 4 KiB unless the value sets prove they never have to
+    Value* memory_at(Value* i, size_t offset, size_t span)
+    {
+        auto memory = program.getNamedGlobal("memory");
+
+        Value* index = builder.CreateAdd(builder.CreateZExt(i, builder.getInt64Ty()), builder.getInt64(offset));
+        if (!in_bounds(span))
+            index = builder.CreateAnd(index, 0xfff);
+
+        return builder.CreateInBoundsGEP(memory->getValueType(), memory, { builder.getInt64(0), index });
+    }
+
+    /*
+     * Copies V0 up to `count` registers to memory at I or back. Registers that
+     * live in the register file move with a single memcpy, unless the copy may
+     * wrap around the end of memory. If the value sets can not rule that out,
+     * I is checked at runtime. Promoted registers go one at a time.
+     */
+    void copy_registers(Value* i, size_t count, bool to_memory)
+    {
+        auto copy = [&](Value* memory)
+        {
+            if (to_memory)
+                builder.CreateMemCpy(memory, MaybeAlign(1), v(0), MaybeAlign(1), count);
+            else
+                builder.CreateMemCpy(v(0), MaybeAlign(1), memory, MaybeAlign(1), count);
+        };
+        auto copy_bytes = [&]()
+        {
+            for (size_t n = 0; n < count; ++n)
+            {
+                if (to_memory)
+                    builder.CreateStore(builder.CreateLoad(builder.getInt8Ty(), v(n)), memory_at(i, n, count));
+                else
+                    builder.CreateStore(builder.CreateLoad(builder.getInt8Ty(), memory_at(i, n, count)), v(n));
+            }
+        };
+
+        if (options.promote_registers)
+        {
+            copy_bytes();
+            return;
+        }
+
+        if (in_bounds(count))
         {
-            auto instr = context.instructions[phys_addr];
-            instr->getParent()->splitBasicBlock(instr, fmt("%x", phys_addr));
-            dst_block = utils::find_block(main->getBasicBlockList(), fmt("%x", phys_addr));
-            builder.CreateBr(dst_block);
+            copy(memory_at(i, 0, count));
+            return;
+        }
+
+        auto func = builder.GetInsertBlock()->getParent();
+        auto fits = BasicBlock::Create(program.getContext(), "", func);
+        auto wraps = BasicBlock::Create(program.getContext(), "", func);
+        auto done = BasicBlock::Create(program.getContext(), "", func);
+
+        auto end = builder.CreateAdd(builder.CreateZExt(i, builder.getInt32Ty()), builder.getInt32(count));
+        builder.CreateCondBr(builder.CreateICmpULE(end, builder.getInt32(0x1000)), fits, wraps);
+
+        builder.SetInsertPoint(fits);
+        auto memory = program.getNamedGlobal("memory");
+        copy(builder.CreateInBoundsGEP(memory->getValueType(), memory, { builder.getInt64(0), builder.CreateZExt(i, builder.getInt64Ty()) }));
+        builder.CreateBr(done);
+
+        builder.SetInsertPoint(wraps);
+        copy_bytes();
+        builder.CreateBr(done);
+
+        builder.SetInsertPoint(done);
+    }
+
+    // address of the sprite at I if it is known and none of its bytes can change
+    std::optional<uint16_t> constant_sprite(size_t height)
+    {
+        if (!constant_i) return std::nullopt;
+
+        for (size_t n = 0; n < height; ++n)
+        {
+            auto addr = *constant_i + n;
+            if (addr >= constant_memory.size() || !constant_memory[addr])
+                return std::nullopt;
+        }
+
+        return constant_i;
+    }
+
+    /*
+     * Returns drw_N(I, x, y), which blits an N row sprite and returns the
+     * collision flag. Every drw site with the same height shares it, whether
+     * it is inlined is up to the inliner unless --inline-drw forces it.
+     * A constant `sprite` gets its own drw_ADDR_N with the rows folded in,
+     * drw_wrap_N is used where I may be close enough to the end of memory
+     * that the sprite wraps around.
+     */
+    Function* drw_helper(size_t height, std::optional<uint16_t> sprite = std::nullopt, bool wrap = false)
+    {
+        auto name = sprite ? fmt("drw_%x_%zu", *sprite, height) : fmt(wrap ? "drw_wrap_%zu" : "drw_%zu", height);
+        if (auto func = program.getFunction(name))
+            return func;
+
+        IRBuilderBase::InsertPointGuard guard(builder);
+
+        auto type = FunctionType::get(builder.getInt8Ty(), { builder.getInt16Ty(), builder.getInt8Ty(), builder.getInt8Ty() }, false);
+        auto func = Function::Create(type, Function::InternalLinkage, name, program);
+        if (options.inline_drw)
+            func->addFnAttr(Attribute::AlwaysInline);
+
+        builder.SetInsertPoint(BasicBlock::Create(program.getContext(), "", func));
+
+        auto memory = program.getNamedGlobal("memory");
+        auto screen = program.getNamedGlobal("screen");
+        auto i = func->getArg(0);
+        auto x = func->getArg(1);
+        auto y = func->getArg(2);
+
+        auto i_64 = sprite ? nullptr : builder.CreateZExt(i, builder.getInt64Ty());
+
+        // every row is a 64 bit word with the leftmost pixel in the msb, sprites wrap around both edges
+        auto shift = builder.CreateZExt(builder.CreateAnd(x, builder.getInt8(63)), builder.getInt64Ty());
+
+        Value* collision = builder.getInt64(0);
+        uint32_t rows = 0;
+        for (size_t n = 0; n < height; ++n)
+        {
+            Value* bits;
+            if (sprite)
+            {
+                // empty rows neither change the screen nor collide
+                auto byte = *constant_memory[*sprite + n];
+                if (!byte) continue;
+
+                bits = builder.getInt64((uint64_t)byte << 56);
+            }
+            else
+            {
+                // load byte from sprite
+                Value* index = builder.CreateAdd(i_64, builder.getInt64(n));
+                if (wrap)
+                    index = builder.CreateAnd(index, 0xfff);
+
+                auto sprt = builder.CreateInBoundsGEP(memory->getValueType(), memory, { builder.getInt64(0), index });
+                auto byte = builder.CreateLoad(builder.getInt8Ty(), sprt);
+                bits = builder.CreateShl(builder.CreateZExt(byte, builder.getInt64Ty()), 56);
+            }
+
+            rows |= 1u << n;
+
+            // move the row from the left edge to x
+            bits = builder.CreateIntrinsic(Intrinsic::fshr, { builder.getInt64Ty() }, { bits, bits, shift });
+
+            auto row = builder.CreateAnd(builder.CreateAdd(y, builder.getInt8(n)), builder.getInt8(31));
+            auto dest = builder.CreateInBoundsGEP(screen->getValueType(), screen, { builder.getInt64(0), builder.CreateZExt(row, builder.getInt64Ty()) });
+
+            // xor the row into the screen, pixels that were set before collide
+            auto orig = builder.CreateLoad(builder.getInt64Ty(), dest);
+            collision = builder.CreateOr(collision, builder.CreateAnd(orig, bits));
+            builder.CreateStore(builder.CreateXor(orig, bits), dest);
         }
-        else if (!dst_block && phys_addr == info.address)
+
+        // one bit per screen row the sprite touched, rotated to y like the rows themselves
+        if (rows)
         {
-            auto self = BasicBlock::Create(program.getContext(), fmt("%x", phys_addr), main);
-            builder.CreateBr(self);
-            builder.SetInsertPoint(self);
-            builder.CreateBr(self);
+            auto dirty = program.getNamedGlobal("dirty");
+            auto mask = builder.getInt32(rows);
+            auto touched = builder.CreateIntrinsic(Intrinsic::fshl, { builder.getInt32Ty() }, { mask, mask, builder.CreateZExt(y, builder.getInt32Ty()) });
+            builder.CreateStore(builder.CreateOr(builder.CreateLoad(builder.getInt32Ty(), dirty), touched), dirty);
         }
-        else if (dst_block)
+
+        builder.CreateRet(builder.CreateZExt(builder.CreateIsNotNull(collision), builder.getInt8Ty()));
+        return func;
+    }
+
+    // block at `addr` for a computed jump, addresses that were not lifted end up in the runtime
+    BasicBlock* computed_target(size_t addr)
+    {
+        if (addr < blocks.size() && blocks[addr])
+            return blocks[addr];
+
+        IRBuilderBase::InsertPointGuard guard(builder);
+
+        auto miss = BasicBlock::Create(program.getContext(), "", builder.GetInsertBlock()->getParent());
+        builder.SetInsertPoint(miss);
+        builder.CreateCall(program.getFunction("unknown_jump"), { builder.getInt16(addr) });
+        builder.CreateUnreachable();
+
+        return miss;
+    }
+
+    /*
+     * Target address of the shared dispatcher that every jp V0, addr in the
+     * function branches to. It switches over all leaders, the runtime reports
+     * any other address.
+     */
+    PHINode* indirect_jump()
+    {
+        if (!jump_target)
         {
-            builder.CreateBr(dst_block);
+            IRBuilderBase::InsertPointGuard guard(builder);
+
+            auto& context = program.getContext();
+            auto func = builder.GetInsertBlock()->getParent();
+            auto dispatch = BasicBlock::Create(context, options.debug_names ? "dispatch" : "", func);
+            auto miss = BasicBlock::Create(context, "", func);
+
+            builder.SetInsertPoint(dispatch);
+            jump_target = builder.CreatePHI(builder.getInt16Ty(), 0);
+            auto table = builder.CreateSwitch(jump_target, miss);
+            for (size_t addr = analysis::ENTRY; addr < blocks.size(); ++addr)
+            {
+                auto offset = addr - analysis::ENTRY;
+                if (blocks[addr] && offset < dispatch_targets.size() && dispatch_targets[offset])
+                    table->addCase(builder.getInt16(addr), blocks[addr]);
+            }
+
+            builder.SetInsertPoint(miss);
+            builder.CreateCall(program.getFunction("unknown_jump"), { jump_target });
+            builder.CreateUnreachable();
         }
 
-        auto next_block = BasicBlock::Create(program.getContext(), fmt("%x", info.address + 2), main);
-        builder.SetInsertPoint(next_block);
+        return jump_target;
+    }
+
+    // block of the leader at the guest address, jumps anywhere else leave the function
+    BasicBlock* block(size_t addr)
+    {
+        if (addr < blocks.size() && blocks[addr])
+            return blocks[addr];
+
+        return exit_block();
+    }
+};
+
+using instruction_t = void(*)(instruction_info&, context_info&);
+
+struct instruction
+{
+    static void jp(instruction_info& info, context_info& context)
+    {
+        auto [program, builder] = context.ctx();
+        log(fmt("jp 0x%x", info.addr()));
+
+        builder.CreateBr(context.block(info.addr()));
     }
 
     static void jp_rel(instruction_info& info, context_info& context)
     {
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("jp V0, 0x%x", info.addr()));;
-        context.instructions[info.address] = instr;
+        log(fmt("jp V0, 0x%x", info.addr()));
+
+        auto v0 = builder.CreateLoad(builder.getInt8Ty(), context.v(0));
+        auto target = context.indirect_jump();
+        target->addIncoming(builder.CreateAdd(builder.getInt16(info.addr()), builder.CreateZExt(v0, builder.getInt16Ty())), builder.GetInsertBlock());
+
+        // V0 is one of a few known values, branch to their targets directly and leave anything else to the dispatcher
+        if (auto& offsets = context.values[0])
+        {
+            auto targets = builder.CreateSwitch(v0, target->getParent(), offsets->size());
+            for (auto offset : *offsets)
+                targets->addCase(builder.getInt8(offset), context.computed_target(info.addr() + offset));
+            return;
+        }
+
+        builder.CreateBr(target->getParent());
     }
 
     static void ld_i(instruction_info& info, context_info& context)
     {
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld I, 0x%x", info.addr()));
-        context.instructions[info.address] = instr;
+        log(fmt("ld I, 0x%x", info.addr()));
 
-        auto i = program.getNamedGlobal("I");
+        auto i = context.i();
         auto value = builder.getInt16(info.addr());
         builder.CreateStore(value, i);
     }
@@ -108,10 +566,9 @@ struct instruction
         auto byte = info.byte<0>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld V%x, 0x%x", reg, byte));
-        context.instructions[info.address] = instr;
+        log(fmt("ld V%x, 0x%x", reg, byte));
 
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
         builder.CreateStore(builder.getInt8(byte), v_reg);
     }
 
@@ -121,20 +578,12 @@ struct instruction
         auto byte = info.byte<0>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("se V%x, 0x%x", reg, byte));
-        context.instructions[info.address] = instr;
-
-        auto main = program.getFunction("main");
-        auto dst_f = BasicBlock::Create(program.getContext(), fmt("%x", info.address + 2), main);
-        auto dst_t = BasicBlock::Create(program.getContext(), fmt("%x", info.address + 4), main);
+        log(fmt("se V%x, 0x%x", reg, byte));
 
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
         auto deref = builder.CreateLoad(v_reg);
         auto cond = builder.CreateICmp(CmpInst::Predicate::ICMP_EQ, deref, builder.getInt8(byte));
-        builder.CreateCondBr(cond, dst_t, dst_f);
-
-        builder.SetInsertPoint(dst_f);
-        context.skippable = dst_t;
+        builder.CreateCondBr(cond, context.block(info.next(2)), context.block(info.next()));
     }
 
     static void sne(instruction_info& info, context_info& context)
@@ -143,20 +592,32 @@ struct instruction
         auto byte = info.byte<0>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("sne V%x, 0x%x", reg, byte));
-        context.instructions[info.address] = instr;
+        log(fmt("sne V%x, 0x%x", reg, byte));
 
-        auto main = program.getFunction("main");
-        auto dst_f = BasicBlock::Create(program.getContext(), fmt("%x", info.address + 2), main);
-        auto dst_t = BasicBlock::Create(program.getContext(), fmt("%x", info.address + 4), main);
-        
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
         auto deref = builder.CreateLoad(v_reg);
         auto cond = builder.CreateICmp(CmpInst::Predicate::ICMP_NE, deref, builder.getInt8(byte));
-        builder.CreateCondBr(cond, dst_t, dst_f);
+        builder.CreateCondBr(cond, context.block(info.next(2)), context.block(info.next()));
+    }
+
+    static void skp(instruction_info& info, context_info& context)
+    {
+        auto reg = info.nibble<1>();
+
+        auto [program, builder] = context.ctx();
+        log(fmt("skp V%x", reg));
 
-        builder.SetInsertPoint(dst_f);
-        context.skippable = dst_t;
+        builder.CreateCondBr(context.key_down(reg), context.block(info.next(2)), context.block(info.next()));
+    }
+
+    static void sknp(instruction_info& info, context_info& context)
+    {
+        auto reg = info.nibble<1>();
+
+        auto [program, builder] = context.ctx();
+        log(fmt("sknp V%x", reg));
+
+        builder.CreateCondBr(context.key_down(reg), context.block(info.next()), context.block(info.next(2)));
     }
 
     static void rnd(instruction_info& info, context_info& context)
@@ -165,11 +626,10 @@ struct instruction
         auto byte = info.byte<0>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("rnd V%x, 0x%x", reg, byte));
-        context.instructions[info.address] = instr;
+        log(fmt("rnd V%x, 0x%x", reg, byte));
 
         auto rand = program.getFunction("rand");
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
         auto rand_value = builder.CreateCall(rand, {});
         auto trunc = builder.CreateTrunc(rand_value, builder.getInt8Ty());
         auto and_v = builder.CreateAnd(trunc, builder.getInt8(byte));
@@ -183,65 +643,45 @@ struct instruction
         auto size = info.nibble<3>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("drw V%x, V%x, 0x%x", xnib, ynib, size));
-        context.instructions[info.address] = instr;
-
-        auto ireg = program.getNamedGlobal("I");
-        auto xreg = program.getNamedGlobal(fmt("V%x", xnib));
-        auto yreg = program.getNamedGlobal(fmt("V%x", ynib));
-        auto memory = program.getNamedGlobal("memory");
-        auto screen = program.getNamedGlobal("screen");
-
-        auto i = builder.CreateLoad(ireg);
-        auto x = builder.CreateLoad(xreg);
-        auto y = builder.CreateLoad(yreg);
+        log(fmt("drw V%x, V%x, 0x%x", xnib, ynib, size));
 
-        auto i_64 = builder.CreateIntCast(i, builder.getInt64Ty(), true);
-        auto y_64 = builder.CreateIntCast(y, builder.getInt64Ty(), true);
+        auto i = builder.CreateLoad(builder.getInt16Ty(), context.i());
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xnib));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(ynib));
 
-        for (auto n = 0; n < size; ++n)
-        {
-            auto x_64 = builder.CreateIntCast(x, builder.getInt64Ty(), true);
-
-            // load byte from sprite
-            auto sprt = builder.CreateInBoundsGEP(memory, { GetIntConstant(program, 0), i_64 });
-            auto byte = builder.CreateLoad(sprt);
-
-            // copy each bit (pixel) to its own byte in the screen buffer
-            for (auto bit = 7; bit >= 0; bit--)
-            {
-                // extract bit
-                auto shift = builder.CreateAShr(byte, bit);
-                auto value = builder.CreateAnd(shift, builder.getInt8(1));
-
-                // calculate 1D offset for byte
-                auto tmp0 = builder.CreateMul(builder.getInt64(64), y_64);
-                auto tmp1 = builder.CreateAdd(tmp0, x_64);
-                auto dest = builder.CreateInBoundsGEP(screen, { GetIntConstant(program, 0), tmp1 });
-
-                x_64 = builder.CreateAdd(x_64, builder.getInt64(1));
-
-                // TODO: set VF on collission
-                // xor byte into screen
-                auto orig = builder.CreateLoad(dest);
-                value = builder.CreateXor(orig, value);
-                builder.CreateStore(value, dest);
-            }
-
-            i_64 = builder.CreateAdd(i_64, builder.getInt64(1));
-            y_64 = builder.CreateAdd(y_64, builder.getInt64(1));
-        }
+        auto vf = builder.CreateCall(context.drw_helper(size, context.constant_sprite(size), !context.in_bounds(size)), { i, x, y });
+        builder.CreateStore(vf, context.v(0xf));
 
-        auto draw = program.getFunction("draw");
-        auto buff = builder.CreateGEP(screen, { GetIntConstant(program, 0), GetIntConstant(program, 0) });
-        builder.CreateCall(draw, { buff });
+        context.present();
     }
 
     static void call(instruction_info& info, context_info& context)
     {
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("call 0x%x", info.addr()));
-        context.instructions[info.address] = instr;
+        log(fmt("call 0x%x", info.addr()));
+
+        // the target is not code, the runtime reports it and ends the program
+        auto routine = context.routines[info.addr()];
+        if (context.guest_stack ? !context.blocks[info.addr()] : !routine)
+        {
+            builder.CreateCall(program.getFunction("unknown_call"), { builder.getInt16(info.addr()) });
+            builder.CreateUnreachable();
+            return;
+        }
+
+        if (context.guest_stack)
+        {
+            auto sp = program.getNamedGlobal("sp");
+            auto top = builder.CreateLoad(builder.getInt8Ty(), sp);
+            builder.CreateStore(builder.getInt16(info.next()), context.stack_slot(top));
+            builder.CreateStore(builder.CreateAnd(builder.CreateAdd(top, builder.getInt8(1)), 0xf), sp);
+            builder.CreateBr(context.block(info.addr()));
+            return;
+        }
+
+        context.sync_registers();
+        builder.CreateCall(routine);
+        context.reload_registers();
     }
 
     static void add(instruction_info& info, context_info& context)
@@ -250,10 +690,9 @@ struct instruction
         auto byte = info.byte<0>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("add V%x, 0x%x", reg, byte));
-        context.instructions[info.address] = instr;
+        log(fmt("add V%x, 0x%x", reg, byte));
 
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
         auto deref = builder.CreateLoad(v_reg);
         auto value = builder.CreateAdd(deref, builder.getInt8(byte));
         builder.CreateStore(value, v_reg);
@@ -265,15 +704,14 @@ struct instruction
         auto ynib = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("add V%x, V%x", xnib, ynib));
-        context.instructions[info.address] = instr;
+        log(fmt("add V%x, V%x", xnib, ynib));
 
-        auto xreg = program.getNamedGlobal(fmt("V%x", xnib));
-        auto yreg = program.getNamedGlobal(fmt("V%x", ynib));
-        auto xreg_deref = builder.CreateLoad(xreg);
-        auto yreg_deref = builder.CreateLoad(yreg);
+        auto xreg = context.v(xnib);
+        auto xreg_deref = builder.CreateLoad(builder.getInt8Ty(), xreg);
+        auto yreg_deref = builder.CreateLoad(builder.getInt8Ty(), context.v(ynib));
         auto value = builder.CreateAdd(xreg_deref, yreg_deref);
         builder.CreateStore(value, xreg);
+        context.set_flag([&] { return builder.CreateICmpULT(value, xreg_deref); });
     }
 
     static void add_i_vx(instruction_info& info, context_info& context)
@@ -281,55 +719,67 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("add I, V%x", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("add I, V%x", reg));
 
-        auto vreg = program.getNamedGlobal(fmt("V%x", reg));
-        auto ireg = program.getNamedGlobal("I");
+        auto vreg = context.v(reg);
+        auto ireg = context.i();
         auto vreg_deref = builder.CreateLoad(vreg);
-        auto vreg_deref_64 = builder.CreateIntCast(vreg_deref, builder.getInt16Ty(), true);
+        auto vreg_deref_64 = builder.CreateIntCast(vreg_deref, builder.getInt16Ty(), false);
         auto ireg_deref = builder.CreateLoad(ireg);
         auto value = builder.CreateAdd(ireg_deref, vreg_deref_64);
         builder.CreateStore(value, ireg);
     }
 
-    static void cls(instruction_info& info, context_info& context)
+    static void cls(instruction_info&, context_info& context)
     {
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, "cls");
-        context.instructions[info.address] = instr;
+        log("cls");
+
+        auto screen = program.getNamedGlobal("screen");
+        builder.CreateStore(ConstantAggregateZero::get(screen->getValueType()), screen);
+        builder.CreateStore(builder.getInt32(UINT32_MAX), program.getNamedGlobal("dirty"));
+
+        context.present();
     }
 
-    static void ret(instruction_info& info, context_info& context)
+    static void ret(instruction_info&, context_info& context)
     {
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, "ret");
-        context.instructions[info.address] = instr;
+        log("ret");
+
+        // returns natively, a ret in main ends the program
+        if (!context.guest_stack)
+        {
+            builder.CreateBr(context.exit_block());
+            return;
+        }
+
+        auto sp = program.getNamedGlobal("sp");
+        auto top = builder.CreateAnd(builder.CreateSub(builder.CreateLoad(builder.getInt8Ty(), sp), builder.getInt8(1)), 0xf);
+        builder.CreateStore(top, sp);
+
+        auto addr = builder.CreateLoad(builder.getInt16Ty(), context.stack_slot(top));
+        auto dispatch = builder.CreateSwitch(addr, context.exit_block(), context.return_sites.size());
+        for (auto site : context.return_sites)
+            dispatch->addCase(builder.getInt16(site), context.block(site));
     }
 
     static void sys(instruction_info& info, context_info& context)
     {
-        auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, "sys");
-        //context.instructions[info.address] = instr;
+        log("sys");
 
         jp(info, context);
     }
 
-    // TODO: this is wrong
     static void ld_vx_i(instruction_info& info, context_info& context)
     {
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld V%x, [I]", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("ld V%x, [I]", reg));
 
-        auto i_reg = program.getNamedGlobal("I");
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
-        auto deref = builder.CreateLoad(i_reg);
-        auto value = builder.CreateTrunc(deref, builder.getInt8Ty());
-        builder.CreateStore(value, v_reg);
+        auto i = builder.CreateLoad(builder.getInt16Ty(), context.i());
+        context.copy_registers(i, reg + 1, false);
     }
 
     static void ld_vx_dt(instruction_info& info, context_info& context)
@@ -337,29 +787,50 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld V%x, DT", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("ld V%x, DT", reg));
 
-        auto d_reg = program.getNamedGlobal("DT");
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
 
-        auto value = builder.CreateLoad(d_reg);
+        auto value = builder.CreateCall(program.getFunction("get_delay_timer"));
         builder.CreateStore(value, v_reg);
     }
 
+    static void ld_vx_k(instruction_info& info, context_info& context)
+    {
+        auto reg = info.nibble<1>();
+
+        auto [program, builder] = context.ctx();
+        log(fmt("ld V%x, K", reg));
+
+        // parks in the runtime until a key goes down
+        auto value = builder.CreateCall(program.getFunction("wait_key"));
+        builder.CreateStore(value, context.v(reg));
+    }
+
     static void ld_dt_vx(instruction_info& info, context_info& context)
     {
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld DT, V%x", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("ld DT, V%x", reg));
 
-        auto d_reg = program.getNamedGlobal("DT");
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
+        auto v_reg = context.v(reg);
 
-        auto value = builder.CreateLoad(v_reg);
-        builder.CreateStore(value, d_reg);
+        auto value = builder.CreateLoad(builder.getInt8Ty(), v_reg);
+        builder.CreateCall(program.getFunction("set_delay_timer"), { value });
+    }
+
+    static void ld_st_vx(instruction_info& info, context_info& context)
+    {
+        auto reg = info.nibble<1>();
+
+        auto [program, builder] = context.ctx();
+        log(fmt("ld ST, V%x", reg));
+
+        auto v_reg = context.v(reg);
+
+        auto value = builder.CreateLoad(builder.getInt8Ty(), v_reg);
+        builder.CreateCall(program.getFunction("set_sound_timer"), { value });
     }
     
     static void ld_b_vx(instruction_info& info, context_info& context)
@@ -367,29 +838,23 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld B, V%x", info.nibble<1>()));
-        context.instructions[info.address] = instr;
+        log(fmt("ld B, V%x", info.nibble<1>()));
 
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
-        auto i_reg = program.getNamedGlobal("I");
-        auto memory = program.getNamedGlobal("memory");
+        auto v_reg = context.v(reg);
+        auto i_reg = context.i();
         auto value = builder.CreateLoad(v_reg);
         auto dest = builder.CreateLoad(i_reg);
-        
+
         auto v0 = builder.CreateSDiv(value, builder.getInt8(100));
         auto v1 = builder.CreateSDiv(value, builder.getInt8(10));
         v1 = builder.CreateSRem(v1, builder.getInt8(10));
         auto v2 = builder.CreateSRem(value, builder.getInt8(100));
         v2 = builder.CreateSRem(v2, builder.getInt8(10));
 
-        auto dest_64 = builder.CreateIntCast(dest, builder.getInt64Ty(), true);
-
         Value* values[3] = { v0, v1, v2 };
         for (int i = 0; i < 3; ++i)
         {
-            auto dest = builder.CreateInBoundsGEP(memory, { GetIntConstant(program, 0), dest_64 });
-            builder.CreateStore(values[i], dest);
-            dest_64 = builder.CreateAdd(dest_64, builder.getInt64(1));
+            builder.CreateStore(values[i], context.memory_at(dest, i, 3));
         }
     }
 
@@ -398,18 +863,10 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log(program, builder, fmt("ld [I], V%x", reg));
-        context.instructions[info.address] = instr;
-
-        auto memory = program.getNamedGlobal("memory");
-        auto i_reg = program.getNamedGlobal("I");
-        auto v_reg = program.getNamedGlobal(fmt("V%x", reg));
-        auto value = builder.CreateLoad(v_reg);
-        auto deref = builder.CreateLoad(i_reg);
-        auto deref_64 = builder.CreateIntCast(deref, builder.getInt64Ty(), true);
+        log(fmt("ld [I], V%x", reg));
 
-        auto dest = builder.CreateInBoundsGEP(memory, { GetIntConstant(program, 0), deref_64 });
-        builder.CreateStore(value, dest);
+        auto i = builder.CreateLoad(builder.getInt16Ty(), context.i());
+        context.copy_registers(i, reg + 1, true);
     }
 
     static void shr(instruction_info& info, context_info& context)
@@ -417,8 +874,12 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("shr V%x", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("shr V%x", reg));
+
+        auto v_reg = context.v(reg);
+        auto deref = builder.CreateLoad(builder.getInt8Ty(), v_reg);
+        builder.CreateStore(builder.CreateLShr(deref, 1), v_reg);
+        context.set_flag([&] { return builder.CreateAnd(deref, 1); });
     }
 
     static void shl(instruction_info& info, context_info& context)
@@ -426,8 +887,12 @@ struct instruction
         auto reg = info.nibble<1>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("shl V%x", reg));
-        context.instructions[info.address] = instr;
+        log(fmt("shl V%x", reg));
+
+        auto v_reg = context.v(reg);
+        auto deref = builder.CreateLoad(builder.getInt8Ty(), v_reg);
+        builder.CreateStore(builder.CreateShl(deref, 1), v_reg);
+        context.set_flag([&] { return builder.CreateLShr(deref, 7); });
     }
 
     static void sub(instruction_info& info, context_info& context)
@@ -436,8 +901,26 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("sub V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("sub V%x, V%x", xreg, yreg));
+
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xreg));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(yreg));
+        builder.CreateStore(builder.CreateSub(x, y), context.v(xreg));
+        context.set_flag([&] { return builder.CreateICmpUGE(x, y); });
+    }
+
+    static void subn(instruction_info& info, context_info& context)
+    {
+        auto xreg = info.nibble<1>();
+        auto yreg = info.nibble<2>();
+
+        auto [program, builder] = context.ctx();
+        log(fmt("subn V%x, V%x", xreg, yreg));
+
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xreg));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(yreg));
+        builder.CreateStore(builder.CreateSub(y, x), context.v(xreg));
+        context.set_flag([&] { return builder.CreateICmpUGE(y, x); });
     }
 
     static void xor_v_v(instruction_info& info, context_info& context)
@@ -446,8 +929,11 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("xor V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("xor V%x, V%x", xreg, yreg));
+
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xreg));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(yreg));
+        builder.CreateStore(builder.CreateXor(x, y), context.v(xreg));
     }
 
     static void and_v_v(instruction_info& info, context_info& context)
@@ -456,8 +942,11 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("and V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("and V%x, V%x", xreg, yreg));
+
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xreg));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(yreg));
+        builder.CreateStore(builder.CreateAnd(x, y), context.v(xreg));
     }
 
     static void or_v_v(instruction_info& info, context_info& context)
@@ -466,8 +955,11 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("or V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("or V%x, V%x", xreg, yreg));
+
+        auto x = builder.CreateLoad(builder.getInt8Ty(), context.v(xreg));
+        auto y = builder.CreateLoad(builder.getInt8Ty(), context.v(yreg));
+        builder.CreateStore(builder.CreateOr(x, y), context.v(xreg));
     }
 
     static void ld_v_v(instruction_info& info, context_info& context)
@@ -476,8 +968,9 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("ld V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("ld V%x, V%x", xreg, yreg));
+
+        builder.CreateStore(builder.CreateLoad(builder.getInt8Ty(), context.v(yreg)), context.v(xreg));
     }
 
     static void se_v_v(instruction_info& info, context_info& context)
@@ -486,8 +979,14 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("se V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("se V%x, V%x", xreg, yreg));
+
+        auto x_reg = context.v(xreg);
+        auto y_reg = context.v(yreg);
+        auto x = builder.CreateLoad(x_reg);
+        auto y = builder.CreateLoad(y_reg);
+        auto cond = builder.CreateICmp(CmpInst::Predicate::ICMP_EQ, x, y);
+        builder.CreateCondBr(cond, context.block(info.next(2)), context.block(info.next()));
     }
 
     static void sne_v_v(instruction_info& info, context_info& context)
@@ -496,7 +995,13 @@ struct instruction
         auto yreg = info.nibble<2>();
 
         auto [program, builder] = context.ctx();
-        auto instr = log<false>(program, builder, fmt("sne V%x, V%x", xreg, yreg));
-        context.instructions[info.address] = instr;
+        log(fmt("sne V%x, V%x", xreg, yreg));
+
+        auto x_reg = context.v(xreg);
+        auto y_reg = context.v(yreg);
+        auto x = builder.CreateLoad(x_reg);
+        auto y = builder.CreateLoad(y_reg);
+        auto cond = builder.CreateICmp(CmpInst::Predicate::ICMP_NE, x, y);
+        builder.CreateCondBr(cond, context.block(info.next(2)), context.block(info.next()));
     }
 };
\ No newline at end of file
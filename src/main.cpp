@@ -3,13 +3,11 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IRReader/IRReader.h>
-#include <llvm/IR/NoFolder.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
-#include <llvm/ExecutionEngine/Interpreter.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Linker/IRMover.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <iostream>
 #include <vector>
@@ -19,116 +17,160 @@
 #include <iomanip>
 #include <cstdio>
 #include <filesystem>
-#include <future>
+#include <optional>
 
 #include "instructions.hpp"
+#include "decoder.hpp"
+#include "analysis.hpp"
+#include "optimizer.hpp"
+#include "engine.hpp"
+#include "emitter.hpp"
+#include "batch.hpp"
 #include "argparse.hpp"
 
 using namespace llvm;
 
-const uint16_t MASKS[] = { 0xffff, 0xf0ff, 0xf00f, 0xf000 };
-static const std::unordered_map<uint16_t, instruction_t> INSTRUCTIONS =
+/* whole program analyses, shared by every function that is lifted */
+struct program_facts
 {
-    { 0x00e0, instruction::cls },
-    { 0x00ee, instruction::ret },
-    { 0xf055, instruction::ld_i_vx },
-    { 0xf065, instruction::ld_vx_i },
-    { 0xf033, instruction::ld_b_vx },
-    { 0xf01e, instruction::add_i_vx },
-    { 0xf007, instruction::ld_vx_dt },
-    { 0xf015, instruction::ld_dt_vx },
-    { 0x0000, instruction::sys },
-    { 0x1000, instruction::jp },
-    { 0xb000, instruction::jp_rel },
-    { 0xa000, instruction::ld_i },
-    { 0x6000, instruction::ld_reg },
-    { 0x3000, instruction::se },
-    { 0x4000, instruction::sne },
-    { 0x5000, instruction::se_v_v },
-    { 0x9000, instruction::sne_v_v },
-    { 0xc000, instruction::rnd },
-    { 0xd000, instruction::drw },
-    { 0x2000, instruction::call },
-    { 0x7000, instruction::add },
-    { 0x8000, instruction::ld_v_v },
-    { 0x8001, instruction::or_v_v },
-    { 0x8002, instruction::and_v_v },
-    { 0x8003, instruction::xor_v_v },
-    { 0x8004, instruction::add_v_v },
-    { 0x8005, instruction::sub },
-    { 0x8006, instruction::shr },
-    { 0x800e, instruction::shl }
+    analysis::jump_map jumps{};
+    analysis::code_map dispatch_targets{};
+    analysis::state_map states{};
+    std::vector<std::optional<uint16_t>> i_values{};
+    std::array<std::optional<uint8_t>, 0x1000> constant_memory{};
+    analysis::code_map headers{};
+    std::vector<analysis::idle> idle_loops{};
+    analysis::code_map live_flags{};
 };
- 
-void handle_instructions(const std::vector<uint8_t>& data, const std::vector<std::pair<size_t, size_t>>& code_blocks, Module& program, IRBuilder<NoFolder>& builder)
+
+program_facts analyze(const std::vector<uint8_t>& data, const analysis::code_map& code, const analysis::jump_map& jumps, const lift_options& options)
 {
-    context_info context{ program, builder };
+    program_facts facts{ jumps };
+    facts.dispatch_targets = analysis::find_leaders(data, code, jumps);
+
+    /* sprites at a known I in memory that is never written are folded into the drw */
+    facts.states = analysis::find_value_sets(data, code, jumps);
+    facts.i_values = analysis::find_constants(facts.states, analysis::I);
+    auto written = analysis::find_written_memory(data, code, facts.states);
+    for (size_t addr = 0; addr < facts.constant_memory.size(); ++addr)
+    {
+        if (written[addr]) continue;
+
+        auto offset = addr - analysis::ENTRY;
+        facts.constant_memory[addr] = addr >= analysis::ENTRY && offset < data.size() ? data[offset] : 0;
+    }
+
+    facts.headers = options.tier_up ? analysis::find_loop_headers(data, code, jumps) : analysis::code_map(data.size(), false);
+    facts.idle_loops = analysis::find_idle_loops(data, code);
+    facts.live_flags = analysis::find_live_flags(data, code);
+    return facts;
+}
 
+/*
+ * Lifts `body` into the function the builder is in. Calls use the native
+ * functions in `routines` or the guest stack, the function starts at `entry`
+ * unless it is resume(pc).
+ */
+void handle_instructions(const std::vector<uint8_t>& data, const program_facts& facts, const analysis::code_map& body, size_t entry, const routine_map& routines, bool guest_stack, Module& program, IRBuilder<>& builder, const lift_options& options)
+{
+    context_info context{ program, builder, options };
+    context.routines = routines;
+    context.guest_stack = guest_stack;
+    context.init_registers();
+
+    /* first pass: create a block for every leader */
+    auto func = builder.GetInsertBlock()->getParent();
+    auto leaders = analysis::find_leaders(data, body, facts.jumps);
+    leaders[entry] = body[entry];
+    context.dispatch_targets = facts.dispatch_targets;
+    context.constant_memory = facts.constant_memory;
     for (size_t pc = 0; pc < data.size(); pc += 2)
     {
-        bool is_code = false;
-        for (auto& [start, end] : code_blocks)
+        if (!leaders[pc]) continue;
+
+        auto addr = analysis::ENTRY + pc;
+        context.blocks[addr] = BasicBlock::Create(program.getContext(), options.debug_names ? fmt("%x", addr) : "", func);
+    }
+
+    /* a ret through the guest stack continues after any call */
+    for (size_t pc = 0; pc + 2 < data.size(); pc += 2)
+    {
+        if (body[pc] && body[pc + 2] && get_nibble(analysis::fetch(data, pc), 0) == 0x2)
+            context.return_sites.push_back(analysis::ENTRY + pc + 2);
+    }
+
+    /* resume(pc) continues at any leader */
+    if (options.resume)
+    {
+        auto dispatch = builder.CreateSwitch(func->getArg(0), context.exit_block());
+        for (size_t addr = 0; addr < context.blocks.size(); ++addr)
         {
-            if (pc >= start && pc <= end)
-            {
-                is_code = true;
-                break;
-            }
+            if (context.blocks[addr])
+                dispatch->addCase(builder.getInt16(addr), context.blocks[addr]);
         }
+    }
+    else
+    {
+        builder.CreateBr(context.block(analysis::ENTRY + entry));
+    }
 
-        if (!is_code) continue;
+    /* second pass: lift straight-line code into the blocks */
+    for (size_t pc = 0; pc < data.size(); pc += 2)
+    {
+        if (!body[pc]) continue;
 
         auto instruction = (data[pc] << 8) | data[pc + 1];
+        auto handler = decoder::decode(instruction);
 
-        std::unordered_map<uint16_t, instruction_t>::const_iterator handler;
-        for (auto mask : MASKS)
+        if (leaders[pc])
         {
-            handler = INSTRUCTIONS.find(instruction & mask);
+            auto block = context.blocks[analysis::ENTRY + pc];
+            if (!builder.GetInsertBlock()->getTerminator())
+                builder.CreateBr(block);
+            builder.SetInsertPoint(block);
 
-            if (handler != INSTRUCTIONS.end()) break;
+            if (facts.headers[pc])
+                context.tier_up(analysis::ENTRY + pc);
+
+            if (options.clock_hz)
+            {
+                size_t count = 1;
+                while (pc + 2 * count < body.size() && body[pc + 2 * count] && !leaders[pc + 2 * count]) count++;
+                context.pace(count);
+            }
         }
 
-        std::cout << std::setfill('0') << std::setw(4) << std::hex << (int)(0x200 + pc) << ": ";
-        if (handler != INSTRUCTIONS.end())
+        if (utils::listing)
+            std::cout << std::setfill('0') << std::setw(4) << std::hex << (int)(0x200 + pc) << ": ";
+        if (handler)
         {
-            instruction_info info(instruction, pc);
+            auto block = builder.GetInsertBlock();
+            auto last = block->empty() ? nullptr : &block->back();
 
-            auto block = context.basic_blocks.find(pc);
-            if (block != context.basic_blocks.end())
-            {
-                auto main = program.getFunction("main");
-                auto dst_block = utils::find_block(main->getBasicBlockList(), fmt("%x", pc));
-                
-                if (!dst_block)
-                    dst_block = BasicBlock::Create(program.getContext(), fmt("%x", pc), main);
-                
-                builder.SetInsertPoint(block->second);
-                builder.CreateBr(dst_block);
-                builder.SetInsertPoint(dst_block);
-
-                context.basic_blocks.erase(block);
-            }
+            /* polling loops sleep until they are done instead of spinning */
+            if (facts.idle_loops[pc] != analysis::idle::none)
+                context.wait(facts.idle_loops[pc], get_nibble(instruction, 1));
 
-            bool ignore_skippable = context.skippable == nullptr;
-            handler->second(info, context);
+            instruction_info info(instruction, pc);
+            context.values = facts.states[pc] ? *facts.states[pc] : analysis::register_sets{};
+            context.constant_i = facts.i_values[pc];
+            context.flag_live = facts.live_flags[pc];
+            handler(info, context);
 
-            if (!ignore_skippable && context.skippable)
-            {
-                if (!context.skippable->getTerminator())
-                    builder.CreateBr(context.skippable);
-                builder.SetInsertPoint(context.skippable);
-                context.skippable = nullptr;
-            }
+            utils::tag_address(block, last, analysis::ENTRY + pc);
         }
-        else
+        else if (utils::listing)
         {
             std::cout << "UNKNOWN " << (int)instruction << std::endl;
             //__debugbreak();
         }
     }
+
+    if (!builder.GetInsertBlock()->getTerminator())
+        builder.CreateBr(context.exit_block());
 }
 
-void add_externals(Module& program, IRBuilder<NoFolder>& builder)
+void add_externals(Module& program, IRBuilder<>& builder)
 {
     auto type = FunctionType::get(builder.getInt32Ty(), {}, false);
     program.getOrInsertFunction("rand", type);
@@ -145,81 +187,46 @@ void add_externals(Module& program, IRBuilder<NoFolder>& builder)
     type = FunctionType::get(builder.getInt32Ty(), args, false);
     program.getOrInsertFunction("printf", type);
 
-    args = { builder.getInt8Ty()->getPointerTo() };
+    args = { builder.getInt64Ty()->getPointerTo(), builder.getInt32Ty() };
     type = FunctionType::get(builder.getVoidTy(), args, false);
     program.getOrInsertFunction("draw", type);
 
     type = FunctionType::get(builder.getVoidTy(), {}, false);
     program.getOrInsertFunction("init", type);
 
-    args = { builder.getInt8Ty()->getPointerTo() };
-    type = FunctionType::get(builder.getVoidTy(), args, false);
-    program.getOrInsertFunction("start_delay_timer", type);
-}
-
-void dump_to_file(Module& program, std::string& name)
-{
-    std::string ir;
-    raw_string_ostream stream(ir);
-    program.print(stream, nullptr);
-
-    auto ir_path = name.append(".ll");
-    std::ofstream output(ir_path);
-    output << ir;
-    output.close();
-}
-
-std::future<void> execute(Module& program, std::vector<uint8_t>& data)
-{
-    InitializeNativeTarget();
-    InitializeNativeTargetAsmPrinter();
-    InitializeNativeTargetAsmParser();
-
-    std::unique_ptr<Module> ptr(&program);
-    std::string error;
-    auto vm = EngineBuilder(std::move(ptr))
-        .setErrorStr(&error)
-        .setEngineKind(EngineKind::Interpreter)
-        .create();
-
-    if (!error.empty())
-    {
-        printf("Execution error: %s\n", error.c_str());
-        return std::async(std::launch::async, [] {});
-    }
+    type = FunctionType::get(builder.getInt8Ty(), {}, false);
+    program.getOrInsertFunction("get_delay_timer", type);
+    program.getOrInsertFunction("get_sound_timer", type);
+    program.getOrInsertFunction("wait_key", type);
 
-    /*SMDiagnostic err;
-    auto lib = parseIRFile("..\\lib.ll", err, context);
+    type = FunctionType::get(builder.getVoidTy(), {}, false);
+    program.getOrInsertFunction("wait_delay_timer", type);
 
-    vm->addModule(std::move(lib));*/
-    vm->finalizeObject();
+    args = { builder.getInt8Ty(), builder.getInt8Ty() };
+    type = FunctionType::get(builder.getVoidTy(), args, false);
+    program.getOrInsertFunction("wait_keypad", type);
 
-    auto future = std::async(std::launch::async, [&]
-        {
-            auto main = program.getFunction("main");
-            vm->runFunction(main, { });
-        });
+    args = { builder.getInt8Ty() };
+    type = FunctionType::get(builder.getVoidTy(), args, false);
+    program.getOrInsertFunction("set_delay_timer", type);
+    program.getOrInsertFunction("set_sound_timer", type);
 
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    auto screen = (uint8_t*)vm->getAddressToGlobalIfAvailable("screen");
-    auto memory = (uint8_t*)vm->getAddressToGlobalIfAvailable("memory");
+    program.getOrInsertGlobal("keypad", builder.getInt16Ty());
 
-    printf("ROM: ");
-    for (int i = 0; i < data.size(); ++i)
-    {
-        printf("%02x ", memory[0x200 + i]);
-    }
-    printf("\n");
+    args = { builder.getInt32Ty(), builder.getInt8Ty() };
+    type = FunctionType::get(builder.getVoidTy(), args, false);
+    program.getOrInsertFunction("set_clock", type);
 
-    for (int i = 0; i < 64 * 32; ++i)
-    {
-        printf("%02x ", screen[i]);
-    }
+    type = FunctionType::get(builder.getInt32Ty(), {}, false);
+    program.getOrInsertFunction("yield_frame", type);
 
-    return future;
+    args = { builder.getInt16Ty() };
+    type = FunctionType::get(builder.getVoidTy(), args, false);
+    program.getOrInsertFunction("unknown_jump", type);
+    program.getOrInsertFunction("unknown_call", type);
 }
 
-void fill_non_terminated_blocks(Function* func, IRBuilder<NoFolder>& builder)
+void fill_non_terminated_blocks(Function* func, IRBuilder<>& builder)
 {
     auto print = func->getParent()->getFunction("printf");
     auto fmt = builder.CreateGlobalStringPtr("NON TERMINATED BLOCK REACHED: %s\n", "fmt");
@@ -237,6 +244,20 @@ void fill_non_terminated_blocks(Function* func, IRBuilder<NoFolder>& builder)
     }
 }
 
+void promote_registers(Function* func)
+{
+    std::vector<AllocaInst*> allocas;
+    for (auto& inst : func->getEntryBlock())
+    {
+        auto alloca = dyn_cast<AllocaInst>(&inst);
+        if (alloca && isAllocaPromotable(alloca))
+            allocas.push_back(alloca);
+    }
+
+    DominatorTree tree(*func);
+    PromoteMemToReg(allocas, tree);
+}
+
 void remove_dead_blocks(Function* func)
 {
     std::vector<BasicBlock*> dead_blocks;
@@ -254,51 +275,210 @@ void remove_dead_blocks(Function* func)
     }
 }
 
-auto parse_args(int argc, char* argv[])
+std::unique_ptr<Module> lift(LLVMContext& context, const std::string& name, const std::vector<uint8_t>& data, const analysis::code_map& code, const analysis::jump_map& jumps, const lift_options& options)
 {
-    /*
-        ./llvm8 --rom ./boot.ch8 --code 0-90
-    */
+    auto module = std::make_unique<Module>(name, context);
+    auto& program = *module;
+    IRBuilder<> builder(context);
+
+    add_externals(program, builder);
+
+    /* set up the register file V0-Vf and I, DT and ST live in the runtime */
+    std::vector<GlobalVariable*> state;
+    state.push_back(utils::create_global(program, "I", builder.getInt16Ty()));
+    state.push_back(utils::create_global(program, "V", ArrayType::get(builder.getInt8Ty(), 16)));
 
-    auto split = [](std::string value, const std::string& delimiter)
+    /* set up 4kb memory page */
+    auto memory = state.emplace_back(utils::create_global(program, "memory", ArrayType::get(builder.getInt8Ty(), 4096), data, 0x200));
+
+    /* set up 64*32 screen buffer, one 64 bit word per row */
+    auto screen = state.emplace_back(utils::create_global(program, "screen", ArrayType::get(builder.getInt64Ty(), 32)));
+
+    /* rows drw changed since the last draw, one bit each */
+    state.push_back(utils::create_global(program, "dirty", builder.getInt32Ty()));
+
+    /* guest instructions left until the next yield_frame */
+    if (options.clock_hz)
+        state.push_back(utils::create_global(program, "budget", builder.getInt32Ty()));
+
+    /* the host inspects these after execution */
+    memory->setLinkage(GlobalValue::ExternalLinkage);
+    screen->setLinkage(GlobalValue::ExternalLinkage);
+
+    /* set up stack */
+    state.push_back(utils::create_global(program, "stack", ArrayType::get(builder.getInt16Ty(), 16)));
+    state.push_back(utils::create_global(program, "sp", builder.getInt8Ty()));
+
+    /* both tiers run on the same guest state, tier 1 only declares it */
+    if (options.tier_up || options.resume)
     {
-        std::vector<std::string> splitted;
-        size_t pos = 0;
-        while ((pos = value.find(delimiter)) != std::string::npos)
+        for (auto global : state)
         {
-            splitted.push_back(value.substr(0, pos));
-            value.erase(0, pos + delimiter.size());
+            global->setLinkage(GlobalValue::ExternalLinkage);
+            if (options.resume) global->setInitializer(nullptr);
         }
+    }
+
+    if (options.tier_up)
+    {
+        utils::create_global(program, "counters", ArrayType::get(builder.getInt32Ty(), 0x1000));
 
-        if (!value.empty())
-            splitted.push_back(value);
+        /* published by the host once tier 1 is compiled */
+        auto resume_type = FunctionType::get(builder.getVoidTy(), { builder.getInt16Ty() }, false)->getPointerTo();
+        auto tier1 = cast<GlobalVariable>(program.getOrInsertGlobal("tier1", resume_type));
+        tier1->setInitializer(ConstantPointerNull::get(resume_type));
 
-        if (splitted.empty())
-            splitted.push_back(value);
+        program.getOrInsertFunction("tier_up", FunctionType::get(builder.getVoidTy(), false));
+    }
 
-        return splitted;
-    };
+    if (options.resume)
+    {
+        auto type = FunctionType::get(builder.getVoidTy(), { builder.getInt16Ty() }, false);
+        auto func = Function::Create(type, Function::ExternalLinkage, "resume", program);
 
-    auto extract_code_blocks = [&split](const std::string& value)
+        auto entry = BasicBlock::Create(context, "entrypoint", func);
+        builder.SetInsertPoint(entry);
+    }
+    else
     {
-        std::vector<std::pair<size_t, size_t>> code_blocks;
-        for (auto& range : split(value, ","))
-        {
-            auto ranges = split(range, "-");
-            code_blocks.push_back(std::make_pair(atoi(ranges[0].c_str()), atoi(ranges[1].c_str())));
-        }
+        auto type = FunctionType::get(builder.getVoidTy(), false);
+        auto func = Function::Create(type, Function::ExternalLinkage, "main", program);
+
+        auto entry = BasicBlock::Create(context, "entrypoint", func);
+        builder.SetInsertPoint(entry);
+
+        /* set up graphics */
+        builder.CreateCall(program.getFunction("init"));
+
+        /* pace the guest */
+        if (options.clock_hz)
+            builder.CreateCall(program.getFunction("set_clock"), { builder.getInt32(options.clock_hz), builder.getInt8(options.virtual_time) });
+
+        /* create RNG, a fixed seed keeps virtual time runs reproducible */
+        auto srand_func = program.getFunction("srand");
+        auto time_func = program.getFunction("time");
+        Value* seed = builder.getInt32(0);
+        if (!options.virtual_time)
+            seed = builder.CreateCall(time_func, { builder.getInt32(0) });
+        builder.CreateCall(srand_func, { seed });
+    }
 
-        return code_blocks;
-    };
+    auto func = builder.GetInsertBlock()->getParent();
+
+    /* routines become internal functions unless they can recurse, then calls go through the guest stack */
+    auto bodies = analysis::find_bodies(data, code, jumps);
+    auto depth = analysis::find_call_depth(data, bodies);
+    auto guest_stack = !depth;
+    if (utils::listing)
+    {
+        if (depth) printf("Routines: %zu, call depth %zu%s\n", bodies.size() - 1, *depth, *depth > 16 ? " exceeds the 16 entry stack" : "");
+        else printf("Routines: %zu, recursive calls use the guest stack\n", bodies.size() - 1);
+    }
+
+    routine_map routines{};
+    std::vector<Function*> functions{ func };
+    for (auto& [entry, body] : bodies)
+    {
+        if (!entry || guest_stack) continue;
+
+        auto addr = analysis::ENTRY + entry;
+        routines[addr] = Function::Create(FunctionType::get(builder.getVoidTy(), false), Function::InternalLinkage, utils::fmt("sub_%x", addr), program);
+        functions.push_back(routines[addr]);
+    }
+
+    /* lift instructions, resume(pc) has to continue anywhere */
+    auto facts = analyze(data, code, jumps, options);
+    auto& main_body = options.resume || guest_stack ? code : bodies[0];
+    handle_instructions(data, facts, main_body, 0, routines, guest_stack, program, builder, options);
+
+    /* routines always start at their entry, also in tier 1 */
+    auto routine_options = options;
+    routine_options.resume = false;
+
+    for (auto& [entry, body] : bodies)
+    {
+        auto routine = routines[analysis::ENTRY + entry];
+        if (!entry || !routine) continue;
+
+        builder.SetInsertPoint(BasicBlock::Create(context, "entrypoint", routine));
+        handle_instructions(data, facts, body, entry, routines, guest_stack, program, builder, routine_options);
+    }
+
+    for (auto function : functions)
+    {
+        //remove_dead_blocks(function);
+        fill_non_terminated_blocks(function, builder);
+
+        if (options.promote_registers)
+            promote_registers(function);
+    }
+
+    return module;
+}
+
+struct settings
+{
+    std::string rom;
+    std::optional<std::vector<std::pair<size_t, size_t>>> code_blocks;
+    lift_options lift;
+    PassBuilder::OptimizationLevel opt_level = PassBuilder::OptimizationLevel::O0;
+    std::string passes;
+    std::string engine;
+    emitter::kind emit = emitter::kind::ir;
+    std::optional<std::string> batch;
+    size_t jobs = 0;
+};
+
+settings parse_args(int argc, char* argv[])
+{
+    /*
+        ./llvm8 --rom ./boot.ch8 [--code 0-90]
+    */
 
     argparse::ArgumentParser program("llvm8");
 
     program.add_argument("--rom")
-        .help("path to the rom file")
-        .required();
+        .help("path to the rom file");
+    program.add_argument("--batch")
+        .help("directory of .ch8 files or manifest of \"rom [code]\" lines to compile without running them");
+    program.add_argument("--jobs")
+        .help("number of roms compiled in parallel with --batch, defaults to the number of cores")
+        .default_value(0)
+        .scan<'i', int>();
     program.add_argument("--code")
-        .help("list of code blocks")
-        .required();
+        .help("list of code blocks, overrides the automatic code discovery");
+    program.add_argument("--debug-names")
+        .help("name basic blocks after their guest address")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--promote-registers")
+        .help("keep V0-VF and I in SSA values, the globals are only updated where they are observable")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--inline-drw")
+        .help("inline the shared sprite drawing helpers into every drw")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--opt-level")
+        .help("optimization pipeline to run on the lifted module: O0, O1, O2, O3 or Os, with --engine tiered it applies to tier 1 (O2 unless given)")
+        .default_value(std::string("O0"));
+    program.add_argument("--passes")
+        .help("additional passes to run after the pipeline, e.g. \"instcombine,gvn\"")
+        .default_value(std::string(""));
+    program.add_argument("--emit")
+        .help("artifact to write to the working directory: ll, bc, asm, obj or exe")
+        .default_value(std::string("ll"));
+    program.add_argument("--clock-hz")
+        .help("guest instructions per second, e.g. 700, the rom runs at host speed unless given")
+        .default_value(0)
+        .scan<'i', int>();
+    program.add_argument("--virtual-time")
+        .help("derive DT and ST from the instructions retired at --clock-hz instead of the wall clock and never sleep")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--engine")
+        .help("how to execute the lifted module: jit, tiered or interpreter")
+        .default_value(std::string("jit"));
 
     try
     {
@@ -311,84 +491,187 @@ auto parse_args(int argc, char* argv[])
         exit(0);
     }
 
-    auto rom = program.get("--rom");
-    auto code_blocks = extract_code_blocks(program.get("--code"));
-
-    return std::make_pair(rom, code_blocks);
-}
+    settings result;
+    result.batch = program.present("--batch");
+    result.jobs = program.get<int>("--jobs");
 
-int main(int argc, char* argv[])
-{
-    auto [rom, code_blocks] = parse_args(argc, argv);
-
-    std::filesystem::path path{ rom };
-    auto data = utils::read_file(path);
-    auto name = path.filename().string();
+    if (auto rom = program.present("--rom"))
+        result.rom = *rom;
+    else if (!result.batch)
+    {
+        std::cout << "--rom or --batch is required" << std::endl;
+        std::cout << program;
+        exit(0);
+    }
+    result.lift.debug_names = program.get<bool>("--debug-names");
+    result.lift.promote_registers = program.get<bool>("--promote-registers");
+    result.lift.inline_drw = program.get<bool>("--inline-drw");
+    result.lift.clock_hz = std::max(0, program.get<int>("--clock-hz"));
+    result.lift.virtual_time = program.get<bool>("--virtual-time");
+    result.passes = program.get("--passes");
+    result.engine = program.get("--engine");
+    result.lift.tier_up = result.engine == "tiered";
+
+    if (result.engine != "jit" && result.engine != "tiered" && result.engine != "interpreter")
+    {
+        std::cout << "Unknown engine: " << result.engine << std::endl;
+        std::cout << program;
+        exit(0);
+    }
 
-    LLVMContext context;
-    IRBuilder<NoFolder> builder(context);
-    Module program(name, context);
+    if (result.lift.virtual_time && !result.lift.clock_hz)
+    {
+        std::cout << "--virtual-time needs --clock-hz" << std::endl;
+        std::cout << program;
+        exit(0);
+    }
 
-    auto type = FunctionType::get(builder.getVoidTy(), false);
-    auto func = Function::Create(type, Function::ExternalLinkage, "main", program);
+    if (auto code = program.present("--code"))
+        result.code_blocks = analysis::parse_ranges(*code);
 
-    auto entry = BasicBlock::Create(context, "entrypoint", func);
-    builder.SetInsertPoint(entry);
+    auto emit = emitter::parse_kind(program.get("--emit"));
+    if (!emit)
+    {
+        std::cout << "Unknown output kind: " << program.get("--emit") << std::endl;
+        std::cout << program;
+        exit(0);
+    }
+    result.emit = *emit;
 
-    add_externals(program, builder);
+    // tier 0 calls back into the engine to tier up, a linked executable has no engine
+    if (result.lift.tier_up && result.emit == emitter::kind::executable)
+    {
+        std::cout << "--engine tiered can not be used with --emit exe" << std::endl;
+        std::cout << program;
+        exit(0);
+    }
 
-    /* set up registers V0-Vf, I, ST and DT */
-    utils::create_global(program, "I", builder.getInt16Ty());
-    utils::create_global(program, "ST", builder.getInt8Ty());
-    auto dt = utils::create_global(program, "DT", builder.getInt8Ty());
-    for (int i = 0; i < 16; ++i)
+    auto level = optimizer::parse_level(program.get("--opt-level"));
+    if (!level)
     {
-        utils::create_global(program, utils::fmt("V%x", i), builder.getInt8Ty());
+        std::cout << "Unknown optimization level: " << program.get("--opt-level") << std::endl;
+        std::cout << program;
+        exit(0);
     }
+    result.opt_level = *level;
 
-    /* set up 4kb memory page */
-    auto memory = utils::create_global(program, "memory", ArrayType::get(builder.getInt8Ty(), 4096), data, 0x200);
+    return result;
+}
 
-    /* set up 64*32 screen buffer */
-    utils::create_global(program, "screen", ArrayType::get(builder.getInt8Ty(), 64*32));
+int compile_batch(const settings& args)
+{
+    auto jobs = batch::load(*args.batch);
+    auto threads = args.jobs > 0 ? args.jobs : std::max(1u, std::thread::hardware_concurrency());
 
-    /* set up stack */
-    utils::create_global(program, "stack", ArrayType::get(builder.getInt16Ty(), 16));
+    auto options = args.lift;
+    options.tier_up = false;
 
-    /* set up graphics */
-    builder.CreateCall(program.getFunction("init"));
+    engine::initialize();
 
-    /* start timers */
-    auto dt_func = program.getFunction("start_delay_timer");
-    builder.CreateCall(dt_func, { dt });
+    // every job gets its own context, nothing is shared between workers
+    auto compile = [&](const batch::job& job)
+    {
+        auto data = utils::read_file(job.rom);
+        analysis::jump_map jumps;
+        auto code = job.code_blocks
+            ? analysis::from_ranges(data, *job.code_blocks)
+            : analysis::discover_code(data, jumps);
+        if (job.code_blocks)
+            jumps = analysis::find_jumps(data, code);
+
+        LLVMContext context;
+        auto program = lift(context, job.name.string(), data, code, jumps, options);
+
+        if (verifyModule(*program, &errs()))
+            return false;
+        if (!optimizer::run(*program, args.opt_level, args.passes))
+            return false;
+
+        return emitter::emit(*program, args.emit, emitter::output_path(job.name, args.emit));
+    };
 
-    /* create RNG */
-    auto srand_func = program.getFunction("srand");
-    auto time_func = program.getFunction("time");
-    auto seed = builder.CreateCall(time_func, { builder.getInt32(0) });
-    builder.CreateCall(srand_func, { seed });
+    printf("== Batch ==\n");
+    return batch::run(jobs, threads, compile) ? 0 : 1;
+}
 
-    /* lift instructions */
-    handle_instructions(data, code_blocks, program, builder);
+int main(int argc, char* argv[])
+{
+    auto args = parse_args(argc, argv);
+    auto& options = args.lift;
+
+    if (args.batch)
+        return compile_batch(args);
+
+    std::filesystem::path path{ args.rom };
+    auto data = utils::read_file(path);
+    auto name = path.filename().string();
 
-    builder.CreateRetVoid();
+    printf("== Code Discovery ==\n");
+    analysis::jump_map jumps;
+    auto code = args.code_blocks
+        ? analysis::from_ranges(data, *args.code_blocks)
+        : analysis::discover_code(data, jumps);
+    if (args.code_blocks)
+        jumps = analysis::find_jumps(data, code);
+    printf("Code: %s\n\n", analysis::to_ranges(code).c_str());
 
-    //remove_dead_blocks(func); 
-    fill_non_terminated_blocks(func, builder);
+    auto context = std::make_unique<LLVMContext>();
+    auto module = lift(*context, name, data, code, jumps, options);
+    auto& program = *module;
+    auto func = program.getFunction("main");
 
     printf("\n== Verification ==\n");
     printf("Module: %d\n", !verifyModule(program, &outs()));
     printf("Main: %d\n", !verifyFunction(*func, &outs()));
 
+    printf("\n== Optimization ==\n");
+    if (options.tier_up)
+    {
+        // main starts unoptimized, the pipeline runs on tier 1 once it is requested
+        printf("Main: deferred to tier 1\n");
+    }
+    else
+    {
+        auto before = func->getInstructionCount();
+        if (!optimizer::run(program, args.opt_level, args.passes))
+            return 1;
+        printf("Main: %u -> %u instructions\n", before, func->getInstructionCount());
+    }
+
     printf("\n== Dump ==\n");
     program.dump();
 
-    dump_to_file(program, name);
+    engine::initialize();
+
+    printf("\n== Emission ==\n");
+    // codegen sets the target on the module it is given, the engine gets the original
+    auto output = emitter::output_path(path, args.emit);
+    if (!emitter::emit(*CloneModule(program), args.emit, output))
+        return 1;
+    printf("Wrote %s\n\n", output.c_str());
+
+    if (args.engine == "jit")
+    {
+        engine::jit(std::move(module), std::move(context), data);
+    }
+    else if (args.engine == "tiered")
+    {
+        auto resume_options = options;
+        resume_options.tier_up = false;
+        resume_options.resume = true;
+
+        printf("== Tier 1 ==\n");
+        auto resume_context = std::make_unique<LLVMContext>();
+        auto resume = lift(*resume_context, name, data, code, jumps, resume_options);
+        printf("\n");
 
-    printf("\n");
+        auto level = args.opt_level == PassBuilder::OptimizationLevel::O0 ? PassBuilder::OptimizationLevel::O2 : args.opt_level;
+        engine::tiered(std::move(module), std::move(context), orc::ThreadSafeModule(std::move(resume), std::move(resume_context)), level, args.passes, data);
+    }
+    else
+    {
+        engine::interpret(std::move(module), data);
+    }
 
-    auto task = execute(program, data);
-    task.wait();
-    
     return 0;
 }
\ No newline at end of file
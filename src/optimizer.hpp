@@ -0,0 +1,73 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Support/Error.h>
+
+#include <string>
+#include <optional>
+#include <unordered_map>
+
+using namespace llvm;
+
+namespace optimizer
+{
+    std::optional<PassBuilder::OptimizationLevel> parse_level(const std::string& level)
+    {
+        static const std::unordered_map<std::string, PassBuilder::OptimizationLevel> LEVELS =
+        {
+            { "O0", PassBuilder::OptimizationLevel::O0 },
+            { "O1", PassBuilder::OptimizationLevel::O1 },
+            { "O2", PassBuilder::OptimizationLevel::O2 },
+            { "O3", PassBuilder::OptimizationLevel::O3 },
+            { "Os", PassBuilder::OptimizationLevel::Os }
+        };
+
+        auto found = LEVELS.find(level);
+        if (found == LEVELS.end()) return std::nullopt;
+
+        return found->second;
+    }
+
+    /*
+     * Runs the default new pass manager pipeline for `level` followed by
+     * `passes`, a textual pipeline in the format opt's -passes= expects.
+     */
+    bool run(Module& program, PassBuilder::OptimizationLevel level, const std::string& passes)
+    {
+        PassBuilder builder;
+
+        LoopAnalysisManager loops;
+        FunctionAnalysisManager functions;
+        CGSCCAnalysisManager cgscc;
+        ModuleAnalysisManager modules;
+
+        builder.registerModuleAnalyses(modules);
+        builder.registerCGSCCAnalyses(cgscc);
+        builder.registerFunctionAnalyses(functions);
+        builder.registerLoopAnalyses(loops);
+        builder.crossRegisterProxies(loops, functions, cgscc, modules);
+
+        ModulePassManager pipeline;
+
+        // the default pipeline builder does not accept O0, always inline functions are still inlined like clang does
+        if (level != PassBuilder::OptimizationLevel::O0)
+            pipeline = builder.buildPerModuleDefaultPipeline(level);
+        else
+            pipeline.addPass(AlwaysInlinerPass());
+
+        if (!passes.empty())
+        {
+            if (auto error = builder.parsePassPipeline(pipeline, passes))
+            {
+                printf("Invalid pass pipeline: %s\n", toString(std::move(error)).c_str());
+                return false;
+            }
+        }
+
+        pipeline.run(program, modules);
+        return true;
+    }
+}
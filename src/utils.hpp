@@ -2,7 +2,6 @@
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/NoFolder.h>
 
 #include <iostream>
 #include <cstdio>
@@ -13,6 +12,9 @@ using namespace llvm;
 
 namespace utils
 {
+    // the disassembly is printed while lifting, batch workers turn it off
+    thread_local bool listing = true;
+
     template<typename... Tx>
     static std::string fmt(const char* fmt, Tx&&... args)
     {
@@ -22,6 +24,25 @@ namespace utils
         return buffer;
     }
 
+    std::vector<std::string> split(std::string value, const std::string& delimiter)
+    {
+        std::vector<std::string> splitted;
+        size_t pos = 0;
+        while ((pos = value.find(delimiter)) != std::string::npos)
+        {
+            splitted.push_back(value.substr(0, pos));
+            value.erase(0, pos + delimiter.size());
+        }
+
+        if (!value.empty())
+            splitted.push_back(value);
+
+        if (splitted.empty())
+            splitted.push_back(value);
+
+        return splitted;
+    }
+
     template<typename T = uint8_t>
     std::vector<T> read_file(const std::filesystem::path& path)
     {
@@ -37,23 +58,24 @@ namespace utils
         return buffer;
     }
 
-    template<bool T = true>
-    Instruction* log(Module& program, IRBuilder<NoFolder>& builder, const std::string& instruction)
+    void log(const std::string& instruction)
     {
-        printf("%s\n", instruction.c_str());
+        if (listing)
+            printf("%s\n", instruction.c_str());
+    }
 
-        builder.CreateAdd(builder.getInt32(1337), builder.getInt32(1337)); // NOP sentinel
+    /*
+     * Attaches the guest address to the first instruction that was inserted
+     * into `block` after `last`, which is null if the block was empty.
+     */
+    void tag_address(BasicBlock* block, Instruction* last, uint16_t address)
+    {
+        auto first = last ? last->getNextNode() : (block->empty() ? nullptr : &block->front());
+        if (!first) return;
 
-        if (!T)
-        {
-            auto main = program.getFunction("main");
-            auto curr = &main->back();
-            auto inst = &curr->back();
-            auto node = MDNode::get(builder.getContext(), MDString::get(builder.getContext(), instruction));
-            inst->setMetadata("UNKNOWN", node);
-        }
-        
-        return &builder.GetInsertBlock()->back();
+        auto& context = block->getContext();
+        auto pc = ConstantAsMetadata::get(ConstantInt::get(Type::getInt16Ty(context), address));
+        first->setMetadata("chip8.pc", MDNode::get(context, pc));
     }
 
     template<typename _Type = Type, typename _Value = uint64_t> requires (std::is_same_v<_Type, ArrayType> || std::is_same_v<_Type, IntegerType>)
@@ -95,19 +117,6 @@ namespace utils
         return Constant::getIntegerValue(Ty, APInt(Ty->getPrimitiveSizeInBits(), Val));
     }
 
-    BasicBlock* find_block(Function::BasicBlockListType& basic_blocks, std::string name)
-    {
-        for (auto& basic_block : basic_blocks)
-        {
-            if (basic_block.getName() == name)
-            {
-                return &basic_block;
-            }
-        }
-
-        return nullptr;
-    }
-
     uint8_t get_nibble(uint16_t value, size_t n)
     {
         return (value >> (4 * (3 - n))) & 0x0f;
@@ -0,0 +1,53 @@
+#include <cstdio>
+
+#include "../external/triple_buffer.hpp"
+
+static int failures = 0;
+
+static void expect(bool condition, const char* what)
+{
+    if (condition) return;
+
+    printf("FAILED: %s\n", what);
+    failures++;
+}
+
+int main()
+{
+    uint64_t screen[32]{};
+
+    // a frame that is replaced before it is presented passes its rows on
+    {
+        triple_buffer buffer;
+        buffer.publish(screen, 1 << 0);
+        buffer.publish(screen, 1 << 5);
+
+        auto latest = buffer.latest();
+        expect(latest && latest->dirty == ((1 << 0) | (1 << 5)), "replaced frame keeps its dirty rows");
+        expect(!buffer.latest(), "nothing new after the latest frame was taken");
+    }
+
+    // rows that were presented are not uploaded again
+    {
+        triple_buffer buffer;
+        buffer.publish(screen, 1 << 0);
+        expect(buffer.latest()->dirty == 1 << 0, "first frame");
+
+        buffer.publish(screen, 1 << 3);
+        buffer.publish(screen, 1 << 7);
+        expect(buffer.latest()->dirty == ((1 << 3) | (1 << 7)), "rows shown before are dropped");
+    }
+
+    // the rows of the newest frame arrive with it
+    {
+        triple_buffer buffer;
+        screen[2] = 0xff;
+        buffer.publish(screen, 1 << 2);
+
+        auto latest = buffer.latest();
+        expect(latest->rows[2] == 0xff && latest->dirty == 1 << 2, "frame contents");
+    }
+
+    if (!failures) printf("OK\n");
+    return failures ? 1 : 0;
+}